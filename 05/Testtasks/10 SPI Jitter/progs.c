@@ -0,0 +1,145 @@
+//-------------------------------------------------
+//          TestTask: SPI Jitter
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "os_memory.h"
+#include "os_memheap_drivers.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Number of processes that keep the external SRAM busy
+#define HAMMERS 2
+//! Number of bytes every hammer writes with a single transfer
+#define TRANSFER_SIZE 2048
+//! Duration of every measurement in ms
+#define MEASURE_MS 3000
+//-------------------------------------------------
+
+//! Length of a time slice in ms rounded up, Timer 2 counts up to SCHEDULER_TICK_COMPARE with a prescaler of 1024
+#define SLICE_MS (((SCHEDULER_TICK_COMPARE + 1ul) * 1024 * 1000 + F_CPU - 1) / F_CPU)
+
+/*!
+ * Largest gap in ms between two runs of the ticker that is accepted with the SRAM mutex, given the gap
+ * measured without any hammer. Every hammer may use up one time slice before the ticker runs again,
+ * plus 1 ms for the resolution of the system time. Anything beyond is the bus holding the ticker back.
+ */
+#define MAX_JITTER_MS(idle) ((idle) + HAMMERS * SLICE_MS + 1)
+
+//! Whether the hammers hold the scheduler for their transfers like the driver used to
+volatile bool holdScheduler;
+
+//! Largest gap between two runs of the ticker
+volatile Time maxGap;
+
+/*!
+ * Fills a chunk on the external heap over and over again and checks its end.
+ */
+void tt_hammer(void) {
+    MemAddr const chunk = os_malloc(extHeap, TRANSFER_SIZE);
+    if (chunk == 0) {
+        TEST_FAILED("Out of memory");
+        HALT;
+    }
+    for (uint8_t value = 0;; value++) {
+        if (holdScheduler) {
+            os_enterCriticalSection();
+        }
+        extHeap->driver->fill(chunk, value, TRANSFER_SIZE);
+        if (holdScheduler) {
+            os_leaveCriticalSection();
+        }
+        MemValue check[4];
+        extHeap->driver->readBlock(chunk + TRANSFER_SIZE - sizeof(check), check, sizeof(check));
+        for (uint8_t i = 0; i < sizeof(check); i++) {
+            if (check[i] != value) {
+                TEST_FAILED("Data corrupted");
+                HALT;
+            }
+        }
+    }
+}
+
+/*!
+ * Does not use the SPI bus at all and records how long it had to wait
+ * for the processor between two of its iterations.
+ */
+void tt_ticker(void) {
+    Time last = os_systemTime_precise();
+    while (1) {
+        Time const now = os_systemTime_precise();
+        if (now - last > maxGap) {
+            maxGap = now - last;
+        }
+        last = now;
+    }
+}
+
+/*!
+ * Runs the ticker next to the given number of hammers for MEASURE_MS
+ * and returns the largest gap the ticker has seen.
+ */
+Time tt_measure(uint8_t hammers, bool hold) {
+    ProcessID pids[HAMMERS + 1];
+
+    holdScheduler = hold;
+    pids[0] = os_exec(tt_ticker, DEFAULT_PRIORITY);
+    for (uint8_t i = 1; i <= hammers; i++) {
+        pids[i] = os_exec(tt_hammer, DEFAULT_PRIORITY);
+    }
+    for (uint8_t i = 0; i <= hammers; i++) {
+        if (pids[i] == INVALID_PROCESS) {
+            TEST_FAILED("Too many procs");
+            HALT;
+        }
+    }
+    os_enterCriticalSection();
+    maxGap = 0;
+    os_leaveCriticalSection();
+
+    delayMs(MEASURE_MS);
+
+    for (uint8_t i = 0; i <= hammers; i++) {
+        os_kill(pids[i]);
+    }
+    os_enterCriticalSection();
+    Time const gap = maxGap;
+    os_leaveCriticalSection();
+    return gap;
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+    lcd_clear();
+    lcd_writeProgString(PSTR("Measuring jitter..."));
+
+    Time const idle = tt_measure(0, false);
+    Time const before = tt_measure(HAMMERS, true);
+    Time const after = tt_measure(HAMMERS, false);
+
+    // Jitter in ms without load, with the old driver and with the mutex
+    lcd_clear();
+    lcd_writeProgString(PSTR("Jitter idle:"));
+    lcd_writeDec(idle);
+    lcd_line2();
+    lcd_writeProgString(PSTR("old:"));
+    lcd_writeDec(before);
+    lcd_writeProgString(PSTR(" new:"));
+    lcd_writeDec(after);
+    delayMs(20 * DEFAULT_OUTPUT_DELAY);
+
+    if (after > before || after > MAX_JITTER_MS(idle)) {
+        TEST_FAILED("Jitter too high");
+        HALT;
+    }
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
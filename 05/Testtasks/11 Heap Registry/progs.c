@@ -0,0 +1,117 @@
+//-------------------------------------------------
+//          TestTask: Heap Registry
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "os_memory.h"
+#include "os_memheap_drivers.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Size of the map of the carved heap
+#define BULK_MAPSIZE 64
+//! Log2 of the number of bytes every map entry of the carved heap stands for
+#define BULK_GRANULARITY_SHIFT 3
+//! Number of chunks the allocating process takes from the carved heap
+#define BULK_CHUNKS 3
+//! Size of every chunk of the allocating process
+#define BULK_CHUNK_SIZE 100
+//-------------------------------------------------
+
+#define BULK_USESIZE ((MemSize)BULK_MAPSIZE * 2 << BULK_GRANULARITY_SHIFT)
+
+//! A heap carved out of a shared chunk of the external heap, its map and use area are set by program1
+Heap bulkHeap = {
+    .driver = extSRAM,
+    .mapDriver = extSRAM,
+    .mapSize = BULK_MAPSIZE,
+    .useSize = BULK_USESIZE,
+    .granularityShift = BULK_GRANULARITY_SHIFT,
+    .strategy = OS_MEM_BEST,
+    .name = "bulkHeap",
+};
+
+//! Set by the allocating process once all of its chunks are allocated
+volatile bool allocated;
+
+/*!
+ * Allocates its chunks on the carved heap and waits to be killed.
+ */
+void tt_allocator(void) {
+    for (uint8_t i = 0; i < BULK_CHUNKS; i++) {
+        if (os_malloc(&bulkHeap, BULK_CHUNK_SIZE) == 0) {
+            TEST_FAILED("Out of memory");
+            HALT;
+        }
+    }
+    allocated = true;
+    while (1) {
+    }
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+    lcd_clear();
+    lcd_writeProgString(PSTR("Carving heap..."));
+
+    // The shared chunk is not freed when a process dies, so the carved heap keeps its memory
+    MemAddr const area = os_sh_malloc(extHeap, BULK_MAPSIZE + BULK_USESIZE);
+    if (area == 0) {
+        TEST_FAILED("Out of memory");
+        HALT;
+    }
+    bulkHeap.mapStart = area;
+    bulkHeap.useStart = area + BULK_MAPSIZE;
+    if (!os_registerHeap(&bulkHeap)) {
+        TEST_FAILED("Not registered");
+        HALT;
+    }
+    if (os_registerHeap(&bulkHeap)) {
+        TEST_FAILED("Registered twice");
+        HALT;
+    }
+    if (os_lookupHeap(os_getHeapListLength() - 1) != &bulkHeap) {
+        TEST_FAILED("Not listed");
+        HALT;
+    }
+
+    // Sizes are rounded up to whole map entries
+    MemAddr const small = os_malloc(&bulkHeap, 1);
+    if (small == 0 || os_getChunkSize(&bulkHeap, small) != (1 << BULK_GRANULARITY_SHIFT)) {
+        TEST_FAILED("No rounding");
+        HALT;
+    }
+    os_free(&bulkHeap, small);
+
+    // os_kill has to free the chunks of a process on the carved heap as well
+    ProcessID const pid = os_exec(tt_allocator, DEFAULT_PRIORITY);
+    if (pid == INVALID_PROCESS) {
+        TEST_FAILED("Too many procs");
+        HALT;
+    }
+    while (!allocated) {
+        os_yield();
+    }
+    HeapStats stats;
+    os_getHeapStats(&bulkHeap, &stats);
+    if (stats.ownerBytes[pid] < BULK_CHUNKS * BULK_CHUNK_SIZE) {
+        TEST_FAILED("Chunks missing");
+        HALT;
+    }
+    os_kill(pid);
+    os_getHeapStats(&bulkHeap, &stats);
+    if (stats.ownerBytes[pid] != 0 || stats.freeBytes != BULK_USESIZE) {
+        TEST_FAILED("Chunks not freed");
+        HALT;
+    }
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
@@ -0,0 +1,156 @@
+//-------------------------------------------------
+//          TestTask: Wait Queues
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "os_sync.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Number of processes incrementing the counter under the mutex
+#define INCREMENTERS 3
+//! Number of increments of every incrementer
+#define INCREMENTS 200
+//-------------------------------------------------
+
+//! Protects counter
+Mutex counterMutex = MUTEX_INITIALIZER;
+
+//! Incremented by every incrementer, which gives its time slice away in between reading and writing it
+volatile uint16_t counter;
+
+//! Posted by every incrementer once it is done
+Semaphore done = SEMAPHORE_INITIALIZER(0);
+
+//! Posted by program1 to let the sleeper go on
+Semaphore wakeUp = SEMAPHORE_INITIALIZER(0);
+
+//! Number of times the sleeper ran
+volatile uint16_t sleeperRuns;
+
+//! Locked by processes that are killed while they hold them
+Mutex abandoned[2] = {MUTEX_INITIALIZER, MUTEX_INITIALIZER};
+
+//! Never posted
+Semaphore never = SEMAPHORE_INITIALIZER(0);
+
+/*!
+ * Increments the counter under the mutex and yields while it holds it.
+ */
+void tt_incrementer(void) {
+    for (uint16_t i = 0; i < INCREMENTS; i++) {
+        os_mutex_lock(&counterMutex);
+        uint16_t const value = counter;
+        os_yield();
+        counter = value + 1;
+        os_mutex_unlock(&counterMutex);
+    }
+    os_sem_post(&done);
+}
+
+/*!
+ * Counts its runs, so it must not run while it waits for the semaphore.
+ */
+void tt_sleeper(void) {
+    while (1) {
+        sleeperRuns++;
+        os_sem_wait(&wakeUp);
+    }
+}
+
+/*!
+ * Holds both abandoned mutexes until it is killed.
+ */
+void tt_holder(void) {
+    os_mutex_lock(&abandoned[0]);
+    os_mutex_lock(&abandoned[1]);
+    os_sem_post(&done);
+    os_sem_wait(&never);
+}
+
+/*!
+ * Ends while it holds an abandoned mutex, so it kills itself.
+ */
+void tt_quitter(void) {
+    os_mutex_lock(&abandoned[1]);
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+    lcd_clear();
+    lcd_writeProgString(PSTR("Waiting..."));
+
+    // A waiting process is skipped by the scheduler until the semaphore is posted
+    ProcessID const sleeper = os_exec(tt_sleeper, DEFAULT_PRIORITY);
+    if (sleeper == INVALID_PROCESS) {
+        TEST_FAILED("Too many procs");
+        HALT;
+    }
+    while (sleeperRuns == 0) {
+        os_yield();
+    }
+    delayMs(DEFAULT_OUTPUT_DELAY * 5);
+    if (sleeperRuns != 1 || os_getProcessSlot(sleeper)->state != OS_PS_WAITING) {
+        TEST_FAILED("Sleeper ran");
+        HALT;
+    }
+    os_sem_post(&wakeUp);
+    while (sleeperRuns == 1) {
+        os_yield();
+    }
+    if (sleeperRuns != 2) {
+        TEST_FAILED("Sleeper missed");
+        HALT;
+    }
+    os_kill(sleeper);
+
+    // A killed process gives its mutexes back, whether it is killed by another process or ends itself
+    ProcessID const holder = os_exec(tt_holder, DEFAULT_PRIORITY);
+    if (holder == INVALID_PROCESS) {
+        TEST_FAILED("Too many procs");
+        HALT;
+    }
+    os_sem_wait(&done);
+    os_kill(holder);
+    if (abandoned[0].owner != INVALID_PROCESS || abandoned[1].owner != INVALID_PROCESS) {
+        TEST_FAILED("Mutex kept");
+        HALT;
+    }
+    ProcessID const quitter = os_exec(tt_quitter, DEFAULT_PRIORITY);
+    if (quitter == INVALID_PROCESS) {
+        TEST_FAILED("Too many procs");
+        HALT;
+    }
+    while (os_getProcessSlot(quitter)->state != OS_PS_UNUSED) {
+        os_yield();
+    }
+    if (abandoned[1].owner != INVALID_PROCESS) {
+        TEST_FAILED("Mutex kept at end");
+        HALT;
+    }
+
+    // Increments get lost unless the mutex keeps the other incrementers out
+    for (uint8_t i = 0; i < INCREMENTERS; i++) {
+        if (os_exec(tt_incrementer, DEFAULT_PRIORITY) == INVALID_PROCESS) {
+            TEST_FAILED("Too many procs");
+            HALT;
+        }
+    }
+    for (uint8_t i = 0; i < INCREMENTERS; i++) {
+        os_sem_wait(&done);
+    }
+    if (counter != INCREMENTERS * INCREMENTS) {
+        TEST_FAILED("Lost increments");
+        HALT;
+    }
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
@@ -0,0 +1,137 @@
+//-------------------------------------------------
+//          TestTask: Sleep
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Time the napper sleeps with os_sleep in ms
+#define NAP_MS 200
+//! Time between the deadlines of the sleepers in ms
+#define GAP_MS 100
+//-------------------------------------------------
+
+//! Timer 0 counts per ms, the unit of os_systemTime_ticks
+#define COUNTS_PER_MS (F_CPU / (TC0_PRESCALER * 1000ul))
+//! Timer 0 counts per scheduler tick, a sleeper is made ready in the first tick after its deadline
+#define TICK_COUNTS ((SCHEDULER_TICK_COMPARE + 1ul) * 1024 / TC0_PRESCALER)
+//! Latest a sleeper may run after its deadline: one tick and a ms for the interrupts masked around it
+#define MAX_LATENESS (TICK_COUNTS + COUNTS_PER_MS)
+//! Number of sleepers with consecutive deadlines, the middle one is killed
+#define SLEEPERS 3
+
+//! Number of times the napper ran before and after its nap
+volatile uint8_t napperRuns;
+
+//! Timer 0 counts the napper actually slept
+volatile Time napCounts;
+
+//! Deadline of the next sleeper in ms, it is read by the sleeper when it starts
+volatile Time nextDeadline;
+
+//! Timer 0 counts every sleeper ran after its deadline, negative if it woke up early
+volatile int32_t lateness[MAX_NUMBER_OF_PROCESSES];
+
+//! Set by every sleeper once it woke up
+volatile bool woken[MAX_NUMBER_OF_PROCESSES];
+
+/*!
+ * Sleeps for NAP_MS with os_sleep and measures how long that took.
+ */
+void tt_napper(void) {
+    Time const start = os_systemTime_ticks();
+    napperRuns++;
+    os_sleep(NAP_MS);
+    napCounts = os_systemTime_ticks() - start;
+    napperRuns++;
+}
+
+/*!
+ * Sleeps until nextDeadline with os_sleepUntil and records how late it woke up.
+ */
+void tt_sleeper(void) {
+    ProcessID const self = os_getCurrentProc();
+    Time const deadline = nextDeadline;
+    os_sleepUntil(deadline);
+    lateness[self] = (int32_t)(os_systemTime_ticks() - deadline * COUNTS_PER_MS);
+    woken[self] = true;
+}
+
+// Returns whether the given lateness of a sleeper is within one tick of its deadline.
+static bool inTime(int32_t late) {
+    return late >= 0 && late <= (int32_t)MAX_LATENESS;
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+    lcd_clear();
+    lcd_writeProgString(PSTR("Sleeping..."));
+
+    // A woken sleeper is picked at the tick that wakes it, as the even strategy goes on with the next process
+    os_setSchedulingStrategy(OS_SS_EVEN);
+
+    // A sleeping process is skipped by the scheduler until its time is up
+    ProcessID const napper = os_exec(tt_napper, DEFAULT_PRIORITY);
+    if (napper == INVALID_PROCESS) {
+        TEST_FAILED("Too many procs");
+        HALT;
+    }
+    while (napperRuns == 0) {
+        os_yield();
+    }
+    delayMs(NAP_MS / 2);
+    if (napperRuns != 1 || os_getProcessSlot(napper)->state != OS_PS_SLEEPING) {
+        TEST_FAILED("Napper ran");
+        HALT;
+    }
+    while (napperRuns == 1) {
+        os_yield();
+    }
+    if (!inTime((int32_t)(napCounts - NAP_MS * COUNTS_PER_MS))) {
+        TEST_FAILED("Nap too long");
+        HALT;
+    }
+
+    // The sleepers are queued in the order of their deadlines, the last one has to inherit the wait of the killed one
+    ProcessID sleepers[SLEEPERS];
+    Time const first = os_systemTime_precise() + GAP_MS;
+    for (uint8_t i = 0; i < SLEEPERS; i++) {
+        nextDeadline = first + i * GAP_MS;
+        sleepers[i] = os_exec(tt_sleeper, DEFAULT_PRIORITY);
+        if (sleepers[i] == INVALID_PROCESS) {
+            TEST_FAILED("Too many procs");
+            HALT;
+        }
+        woken[sleepers[i]] = false;
+        while (os_getProcessSlot(sleepers[i])->state != OS_PS_SLEEPING) {
+            os_yield();
+        }
+    }
+    os_kill(sleepers[1]);
+    while (!woken[sleepers[SLEEPERS - 1]]) {
+        os_yield();
+    }
+    if (woken[sleepers[1]]) {
+        TEST_FAILED("Killed one woke");
+        HALT;
+    }
+    if (!woken[sleepers[0]] || !inTime(lateness[sleepers[0]])) {
+        TEST_FAILED("First not in time");
+        HALT;
+    }
+    if (!inTime(lateness[sleepers[SLEEPERS - 1]])) {
+        TEST_FAILED("Last not in time");
+        HALT;
+    }
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
@@ -0,0 +1,131 @@
+//-------------------------------------------------
+//          TestTask: Wide Addresses
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "os_memory.h"
+#include "os_memheap_drivers.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+#if !MEM_WIDE_ADDRESSES
+    #warning "Please set MEM_WIDE_ADDRESSES to 1"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Size of the chunks that reach over the 64 KiB boundary, they start half of it in front of the boundary
+#define CROSS_SIZE 64
+//-------------------------------------------------
+
+//! First address the chip can only be reached at with wide addresses
+#define BOUNDARY 0x10000ul
+
+/*!
+ * Checks that a chunk of the external heap reaches over the 64 KiB boundary.
+ */
+void checkCrossing(MemAddr chunk) {
+    if (chunk == 0) {
+        TEST_FAILED("Out of memory");
+        HALT;
+    }
+    if ((uint32_t)chunk >= BOUNDARY || (uint32_t)chunk + CROSS_SIZE <= BOUNDARY) {
+        TEST_FAILED("Not crossing");
+        HALT;
+    }
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+#if MEM_WIDE_ADDRESSES
+    lcd_clear();
+    lcd_writeProgString(PSTR("Crossing 64 KiB"));
+
+    // Precheck heap
+    if ((uint32_t)os_getUseStart(extHeap) + os_getUseSize(extHeap) < BOUNDARY + CROSS_SIZE) {
+        TEST_FAILED("Heap too small");
+        HALT;
+    }
+    os_setAllocationStrategy(extHeap, OS_MEM_FIRST);
+
+    // A filler takes everything in front of the boundary but half of a chunk
+    MemSize const fillerSize = BOUNDARY - os_getUseStart(extHeap) - CROSS_SIZE / 2;
+    MemAddr const filler = os_malloc(extHeap, fillerSize);
+    if (filler != os_getUseStart(extHeap)) {
+        TEST_FAILED("Heap not empty");
+        HALT;
+    }
+    for (uint8_t i = 0; i < CROSS_SIZE; i++) {
+        extHeap->driver->write(filler + i, 0x55);
+    }
+
+    // Bytes behind the boundary must not end up at their 16 bit alias, which lies in front of the filler
+    MemAddr const chunk = os_malloc(extHeap, CROSS_SIZE);
+    checkCrossing(chunk);
+    for (uint8_t i = 0; i < CROSS_SIZE; i++) {
+        extHeap->driver->write(chunk + i, i);
+    }
+    for (uint8_t i = 0; i < CROSS_SIZE; i++) {
+        if (extHeap->driver->read(chunk + i) != i) {
+            TEST_FAILED("Pattern mismatch");
+            HALT;
+        }
+        if (extHeap->driver->read(filler + i) != 0x55) {
+            TEST_FAILED("Filler changed");
+            HALT;
+        }
+    }
+    if (os_getChunkSize(extHeap, filler) < fillerSize || os_getChunkSize(extHeap, chunk) < CROSS_SIZE) {
+        TEST_FAILED("Map changed");
+        HALT;
+    }
+    os_free(extHeap, chunk);
+
+    // Shared chunks are written and read in one go, also in pieces around the boundary
+    MemAddr shared = os_sh_malloc(extHeap, CROSS_SIZE);
+    checkCrossing(shared);
+    MemValue out[CROSS_SIZE];
+    MemValue in[CROSS_SIZE];
+    for (uint8_t i = 0; i < CROSS_SIZE; i++) {
+        out[i] = CROSS_SIZE - i;
+    }
+    os_sh_write(extHeap, &shared, 0, out, CROSS_SIZE);
+    os_sh_read(extHeap, &shared, 0, in, CROSS_SIZE);
+    for (uint8_t i = 0; i < CROSS_SIZE; i++) {
+        if (in[i] != out[i]) {
+            TEST_FAILED("Shared mismatch");
+            HALT;
+        }
+    }
+    MemSize const around = CROSS_SIZE / 2 - 4;
+    os_sh_write(extHeap, &shared, around, out, 8);
+    os_sh_read(extHeap, &shared, around, in, 8);
+    for (uint8_t i = 0; i < 8; i++) {
+        if (in[i] != out[i] || extHeap->driver->read(shared + around + i) != out[i]) {
+            TEST_FAILED("Piece mismatch");
+            HALT;
+        }
+    }
+    os_sh_free(extHeap, &shared);
+    os_free(extHeap, filler);
+
+    // The whole use area is one chunk again
+    MemAddr const all = os_malloc(extHeap, os_getUseSize(extHeap));
+    if (all != os_getUseStart(extHeap)) {
+        TEST_FAILED("Memory lost");
+        HALT;
+    }
+    os_free(extHeap, all);
+#else
+    TEST_FAILED("Not wide");
+    HALT;
+#endif
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
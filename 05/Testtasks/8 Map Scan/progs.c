@@ -0,0 +1,164 @@
+//-------------------------------------------------
+//          TestTask: Map Scan
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "os_memory.h"
+#include "os_memheap_drivers.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Set this to 1 in order to benchmark the heap, 0 to skip it
+#define INTERNAL 1
+#define EXTERNAL 1
+//! How often every allocation is repeated per measurement on the internal heap
+#define INTERNAL_ROUNDS 20
+//! How often every allocation is repeated per measurement on the external heap
+#define EXTERNAL_ROUNDS 1
+//! Minimal factor by which every strategy has to beat the per-nibble scan
+#define MIN_SPEEDUP 2
+//-------------------------------------------------
+
+//! Number of chunks that make up the fragmentation pattern
+#define PATTERN_CHUNKS 24
+
+//! Number of strategies that are benchmarked
+#define STRATEGIES 4
+
+//! The strategies that are benchmarked and the letters they are shown with
+AllocStrategy const strategies[STRATEGIES] = {OS_MEM_FIRST, OS_MEM_NEXT, OS_MEM_BEST, OS_MEM_WORST};
+char const strategyNames[STRATEGIES] = {'F', 'N', 'B', 'W'};
+
+/*!
+ * First fit as every strategy used to search the map before os_scanMap: every
+ * map entry is read on its own, which reads every map byte twice.
+ */
+MemAddr tt_firstFitPerNibble(Heap const* heap, MemSize size) {
+    MemSize freeSize = 0;
+    MemAddr const end = os_getUseStart(heap) + os_getUseSize(heap);
+    for (MemAddr addr = os_getUseStart(heap); addr < end; addr++) {
+        if (os_getMapEntry(heap, addr) == 0) {
+            freeSize++;
+            if (freeSize == size) {
+                return addr - size + 1;
+            }
+        } else {
+            freeSize = 0;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * Fragments the heap with large chunks and small gaps between them. The chunks
+ * are returned in chunks. The returned size is larger than every gap, so only
+ * the rest of the heap behind the last chunk holds it and every strategy has to
+ * look at every gap in front of it.
+ */
+MemSize tt_fragment(Heap* heap, MemAddr chunks[PATTERN_CHUNKS]) {
+    MemSize const unit = os_getUseSize(heap) / (PATTERN_CHUNKS * 2);
+    MemSize const entry = (MemSize)1 << heap->granularityShift;
+    os_setAllocationStrategy(heap, OS_MEM_FIRST);
+    for (uint8_t i = 0; i < PATTERN_CHUNKS; i++) {
+        chunks[i] = os_malloc(heap, (i % 2) ? 1 + unit * (i % 5) : entry * (1 + i % 3));
+        if (chunks[i] == 0) {
+            TEST_FAILED("Heap not empty");
+            HALT;
+        }
+    }
+    for (uint8_t i = 0; i < PATTERN_CHUNKS; i += 2) {
+        os_free(heap, chunks[i]);
+        chunks[i] = 0;
+    }
+    // Smaller requests would also look for room in the gaps themselves, which are too short to be listed as free extents
+    return (entry * 4 < HEAP_EXTENT_NODE) ? HEAP_EXTENT_NODE : entry * 4;
+}
+
+/*!
+ * Times os_malloc and os_free of a chunk behind the gaps of the fragmented heap with every
+ * strategy and the per-nibble search for it, prints the times and returns
+ * whether every strategy was at least MIN_SPEEDUP times faster.
+ */
+bool tt_benchmark(Heap* heap, uint8_t rounds) {
+    MemAddr chunks[PATTERN_CHUNKS];
+    Time times[STRATEGIES];
+    MemAddr found = 0;
+    bool fast = true;
+
+    MemSize const size = tt_fragment(heap, chunks);
+
+    os_enterCriticalSection();
+    Time start = os_systemTime_precise();
+    for (uint8_t i = 0; i < rounds; i++) {
+        found = tt_firstFitPerNibble(heap, size);
+    }
+    Time const timeNibble = os_systemTime_precise() - start;
+
+    for (uint8_t s = 0; s < STRATEGIES; s++) {
+        os_setAllocationStrategy(heap, strategies[s]);
+        start = os_systemTime_precise();
+        for (uint8_t i = 0; i < rounds; i++) {
+            MemAddr const chunk = os_malloc(heap, size);
+            // Next fit goes on behind the chunk of the round before
+            if (chunk < found) {
+                os_leaveCriticalSection();
+                TEST_FAILED("Wrong chunk");
+                HALT;
+            }
+            os_free(heap, chunk);
+        }
+        times[s] = os_systemTime_precise() - start;
+        fast &= times[s] * MIN_SPEEDUP <= timeNibble;
+    }
+    os_leaveCriticalSection();
+
+    os_setAllocationStrategy(heap, OS_MEM_FIRST);
+    for (uint8_t i = 1; i < PATTERN_CHUNKS; i += 2) {
+        os_free(heap, chunks[i]);
+    }
+
+    lcd_clear();
+    lcd_writeString(heap->name);
+    lcd_writeProgString(PSTR(" old:"));
+    lcd_writeDec(timeNibble);
+    lcd_line2();
+    for (uint8_t s = 0; s < STRATEGIES; s++) {
+        lcd_writeChar(strategyNames[s]);
+        lcd_writeDec(times[s]);
+        lcd_writeChar(' ');
+    }
+    delayMs(20 * DEFAULT_OUTPUT_DELAY);
+
+    return fast;
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+    bool fast = true;
+
+    lcd_clear();
+    lcd_writeProgString(PSTR("Benchmarking strategies (ms)"));
+    delayMs(10 * DEFAULT_OUTPUT_DELAY);
+
+#if INTERNAL
+    fast &= tt_benchmark(intHeap, INTERNAL_ROUNDS);
+#endif
+#if EXTERNAL
+    fast &= tt_benchmark(extHeap, EXTERNAL_ROUNDS);
+#endif
+
+    if (!fast) {
+        TEST_FAILED("Speedup too low");
+        HALT;
+    }
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
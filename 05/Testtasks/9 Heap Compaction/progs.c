@@ -0,0 +1,124 @@
+//-------------------------------------------------
+//          TestTask: Heap Compaction
+//-------------------------------------------------
+
+#include <avr/interrupt.h>
+
+#include "os_core.h"
+#include "os_scheduler.h"
+#include "os_memory.h"
+#include "os_memheap_drivers.h"
+#include "testtask.h"
+
+#if VERSUCH < 5
+    #warning "Please fix the VERSUCH-define"
+#endif
+
+//---- Adjust here what to test -------------------
+//! Set this to 1 in order to test the heap, 0 to skip it
+#define INTERNAL 1
+#define EXTERNAL 1
+//! Size of every relocatable chunk
+#define CHUNK_SIZE 20
+//! Number of compaction steps, enough to move every chunk HEAP_COMPACT_STEP bytes at a time
+#define ROUNDS 100
+//-------------------------------------------------
+
+/*!
+ * Returns whether the relocatable chunk of the handle still holds
+ * the pattern that was written to it by tt_fill.
+ */
+bool tt_check(Heap* heap, MemHandle handle, uint8_t seed) {
+    MemAddr const addr = os_h_open(heap, handle);
+    bool ok = true;
+    for (uint8_t i = 0; i < CHUNK_SIZE; i++) {
+        ok &= heap->driver->read(addr + i) == (uint8_t)(seed + i);
+    }
+    os_h_close(heap, handle);
+    return ok;
+}
+
+/*!
+ * Writes a pattern that depends on the seed to the chunk of the handle.
+ */
+void tt_fill(Heap* heap, MemHandle handle, uint8_t seed) {
+    MemAddr const addr = os_h_open(heap, handle);
+    for (uint8_t i = 0; i < CHUNK_SIZE; i++) {
+        heap->driver->write(addr + i, seed + i);
+    }
+    os_h_close(heap, handle);
+}
+
+/*!
+ * Fragments the heap with plain chunks between relocatable ones, frees the plain
+ * chunks and lets the idle process compact the heap. Afterwards the relocatable
+ * chunks have to be packed at the start of the heap with their contents intact.
+ */
+void tt_compact(Heap* heap) {
+    MemHandle handles[HEAP_HANDLES];
+    MemAddr gaps[HEAP_HANDLES];
+
+    lcd_clear();
+    lcd_writeString(heap->name);
+    lcd_writeProgString(PSTR(": compacting"));
+
+    os_setAllocationStrategy(heap, OS_MEM_FIRST);
+    for (uint8_t i = 0; i < HEAP_HANDLES; i++) {
+        gaps[i] = os_malloc(heap, CHUNK_SIZE + i);
+        handles[i] = os_h_malloc(heap, CHUNK_SIZE);
+        if (gaps[i] == 0 || handles[i] == 0) {
+            TEST_FAILED("Out of memory");
+            HALT;
+        }
+        tt_fill(heap, handles[i], i * 16);
+    }
+    for (uint8_t i = 0; i < HEAP_HANDLES; i++) {
+        os_free(heap, gaps[i]);
+    }
+
+    // An open chunk must stay where it is
+    MemAddr const pinned = os_h_open(heap, handles[0]);
+    for (uint8_t i = 0; i < ROUNDS; i++) {
+        os_compactHeap(heap);
+    }
+    if (os_h_open(heap, handles[0]) != pinned) {
+        TEST_FAILED("Open chunk moved");
+        HALT;
+    }
+    os_h_close(heap, handles[0]);
+    os_h_close(heap, handles[0]);
+
+    // Do what the idle process does whenever it runs
+    for (uint8_t i = 0; i < ROUNDS; i++) {
+        os_compactHeap(heap);
+    }
+
+    for (uint8_t i = 0; i < HEAP_HANDLES; i++) {
+        MemAddr const addr = os_h_open(heap, handles[i]);
+        os_h_close(heap, handles[i]);
+        if (addr != os_getUseStart(heap) + i * CHUNK_SIZE) {
+            TEST_FAILED("Not compacted");
+            HALT;
+        }
+        if (!tt_check(heap, handles[i], i * 16)) {
+            TEST_FAILED("Data corrupted");
+            HALT;
+        }
+    }
+    for (uint8_t i = 0; i < HEAP_HANDLES; i++) {
+        os_h_free(heap, handles[i]);
+    }
+}
+
+REGISTER_AUTOSTART(program1)
+void program1(void) {
+#if INTERNAL
+    tt_compact(intHeap);
+#endif
+#if EXTERNAL
+    tt_compact(extHeap);
+#endif
+
+    // SUCCESS
+    TEST_SUCCESS;
+}
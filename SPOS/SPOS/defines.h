@@ -70,6 +70,17 @@
 //! Number to specify an invalid process
 #define INVALID_PROCESS             255
 
+//! Timer 2 compare value of one scheduler tick (61 counts at prescaler 1024, about 3 ms)
+#define SCHEDULER_TICK_COMPARE      60
+
+//! Set to 0 to keep ticking at the full rate and busy-wait in the idle process
+#ifndef SCHEDULER_TICKLESS_IDLE
+#define SCHEDULER_TICKLESS_IDLE     1
+#endif
+
+//! Timer 2 compare value while only the idle process can run (the 8 bit maximum, about 13 ms)
+#define SCHEDULER_IDLE_TICK_COMPARE 255
+
 //----------------------------------------------------------------------------
 // Stack constants
 //----------------------------------------------------------------------------
@@ -95,7 +106,103 @@
 //! The bottom of the memory chunk with number PID.
 #define PROCESS_STACK_BOTTOM(PID)   (BOTTOM_OF_PROCS_STACK - ((PID) * STACK_SIZE_PROC))
 
+//! The limit of the memory chunk with number PID. That is the lowest address.
+#define PROCESS_STACK_LIMIT(PID)    (PROCESS_STACK_BOTTOM(PID) - STACK_SIZE_PROC + 1)
+
+//! Stack protection policies, i.e. what the scheduler checks when it switches processes
+#define STACK_PROTECTION_OFF        0 // no check
+#define STACK_PROTECTION_CHECKSUM   1 // checksum of the whole used stack on every switch
+#define STACK_PROTECTION_CANARY     2 // canary word at the stack limit
+#define STACK_PROTECTION_SAMPLED    3 // checksum of the whole used stack on every STACK_CHECK_INTERVAL-th switch
+
+//! The stack protection policy
+#ifndef STACK_PROTECTION
+#define STACK_PROTECTION            STACK_PROTECTION_CHECKSUM
+#endif
+
+//! Number of switches between two checksums with STACK_PROTECTION_SAMPLED
+#ifndef STACK_CHECK_INTERVAL
+#define STACK_CHECK_INTERVAL        16
+#endif
+
+//! Word written to the limit of every process stack, the idle process also checks it with every policy
+#define STACK_CANARY                0xC35A
+
+//! Byte the unused part of a process stack is filled with to find its high-water mark
+#define STACK_PAINT                 0xAA
+
+//! 1 widens MemAddr and MemSize to 24 bits, so the external heap covers all 128 KiB of the 23LC1024 instead of the first 64 KiB.
+//! Every address and size kept by the heaps takes a byte more and arithmetic on them gets slower, also on the internal heap
+#ifndef MEM_WIDE_ADDRESSES
+#define MEM_WIDE_ADDRESSES          0
+#endif
+
 // Sicherheitsabstand setzen
-#define HEAPOFFSET					950
+// Room for the global variables in front of the internal heap, os_init checks that they fit.
+// Every 3 bytes more take 2 use bytes from the internal heap: 1240 leaves it 538 use bytes, the 950 of the bare system left 730.
+// The heap bookkeeping holds about 240 bytes more with wide addresses, which leaves 378 use bytes.
+#if MEM_WIDE_ADDRESSES
+#define HEAPOFFSET					1480
+#else
+#define HEAPOFFSET					1240
+#endif
+
+//----------------------------------------------------------------------------
+// Heap constants
+//----------------------------------------------------------------------------
+
+//! Number of heaps that can be registered with os_registerHeap, including the internal and the external heap
+#define MAX_NUMBER_OF_HEAPS         4
+
+//! Largest request in bytes that the slab strategy serves from its size classes
+#define HEAP_SLAB_MAX_SIZE          16
+
+//! Number of slabs every heap can hold at the same time
+#define HEAP_SLABS                  4
+
+//! Number of relocatable chunks every heap can hold at the same time
+#define HEAP_HANDLES                6
+
+//! Maximum number of bytes os_compactHeap copies per call
+#define HEAP_COMPACT_STEP           32
+
+//! Size of the buffer on the stack through which chunks are copied within a heap
+#define HEAP_COPY_BUFFER            16
+
+//----------------------------------------------------------------------------
+// SPI bus
+//----------------------------------------------------------------------------
+
+//! Pin of port B that selects the external SRAM on the SPI bus (B4)
+#ifndef SRAM_CS_BIT
+#define SRAM_CS_BIT                 4
+#endif
+
+//! Pin of port B that selects the touch display on the SPI bus (B1), the chip select of the display has to be wired there
+#ifndef TLCD_CS_BIT
+#define TLCD_CS_BIT                 1
+#endif
+
+#if SRAM_CS_BIT == TLCD_CS_BIT
+#error "The external SRAM and the display need chip selects of their own"
+#endif
+
+//----------------------------------------------------------------------------
+// Memory driver constants
+//----------------------------------------------------------------------------
+
+//! Size of the buffer through which the external SRAM is read into process stacks while the reading process may be switched out
+#define SRAM_BOUNCE_BUFFER          8
+
+//! Number of lines of the cache in front of the external SRAM (at most 8), 0 disables the cache
+#define SRAM_CACHE_LINES            8
+
+//! Bytes per cache line, a power of two. A miss loads the whole line with a single sequential read
+#define SRAM_CACHE_LINE_SIZE        8
+
+//! 1 keeps written bytes in the cache until their line is evicted, 0 writes them through to the external SRAM at once
+#ifndef SRAM_CACHE_WRITE_BACK
+#define SRAM_CACHE_WRITE_BACK       0
+#endif
 
 #endif
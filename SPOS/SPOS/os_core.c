@@ -94,7 +94,7 @@ void os_init_timer(void) {
     sbi(TCCR2B, CS21); // Prescaler 1024  1
     sbi(TCCR2B, CS20); // Prescaler 1024  1
     sbi(TIMSK2, OCIE2A); // Enable interrupt
-    OCR2A = 60;
+    OCR2A = SCHEDULER_TICK_COMPARE;
 
     // Init timer 0 with prescaler 256
     cbi(TCCR0B, CS00);
@@ -2,84 +2,460 @@
 #include "defines.h"
 #include "os_scheduler.h"
 #include "os_spi.h"
+#include "os_sync.h"
 #include "util.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <string.h>
 
 
 void initSRAM_internal(void){}
 	
+// Internal addresses are pointers, MemAddr may be wider than a pointer (see MEM_WIDE_ADDRESSES)
+#define INTERNAL_POINTER(ADDR) ((uint8_t*)(uintptr_t)(ADDR))
+
 MemValue readSRAM_internal(MemAddr addr){
-	return *((uint8_t*)addr);
+	return *INTERNAL_POINTER(addr);
 }
 	
 void writeSRAM_internal(MemAddr addr, MemValue value){
-	*((uint8_t*)addr) = value;
+	*INTERNAL_POINTER(addr) = value;
 }
 	
+void readBlockSRAM_internal(MemAddr addr, MemValue *dest, uint16_t length){
+	memcpy(dest, INTERNAL_POINTER(addr), length);
+}
+
+void writeBlockSRAM_internal(MemAddr addr, MemValue const *src, uint16_t length){
+	memcpy(INTERNAL_POINTER(addr), src, length);
+}
+
+void fillSRAM_internal(MemAddr addr, MemValue value, uint16_t length){
+	memset(INTERNAL_POINTER(addr), value, length);
+}
+
 MemDriver intSRAM__={
 	.init = &initSRAM_internal,
 	.read = &readSRAM_internal,
-	.write = &writeSRAM_internal
+	.write = &writeSRAM_internal,
+	.readBlock = &readBlockSRAM_internal,
+	.writeBlock = &writeBlockSRAM_internal,
+	.fill = &fillSRAM_internal
 };
 
 // Activates the external SRAM as SPI slave.
 void select_memory(){
-	PORTB &= 0b11101111; // Set CS pin low
+	PORTB &= ~(1 << SRAM_CS_BIT); // Set CS pin low
 }
 	
 // Deactivates the external SRAM as SPI slave.
 void deselect_memory(){
-	PORTB |= 0b00010000; // Set CS pin high
+	PORTB |= 1 << SRAM_CS_BIT; // Set CS pin high
 }
 	
+// The external SRAM on the SPI bus, selected by SRAM_CS_BIT and clocked at fOSC/2 in mode 0.
+SpiDevice const sramDevice = {
+	.csMask = 1 << SRAM_CS_BIT,
+	.control = SPI_MODE_0 | SPI_CLOCK_DIV4,
+	.doubleSpeed = true
+};
+
 // Sets the operation mode of the external SRAM.
 void set_operation_mode(uint8_t mode){
-	os_enterCriticalSection();
+	os_spi_lock(&sramDevice);
 	select_memory();
 	os_spi_send(0x01); // Sende den Befehl, um MODE register zu schreiben
 	os_spi_send(mode); // Sende den aktualisierten MODE register Wert
 	deselect_memory();
-	os_leaveCriticalSection();
+	os_spi_unlock();
 }
-	
-// Transmitts a 24bit memory address to the external SRAM.
-void transfer_address(MemAddr addr){
-	 os_spi_send(0x00);
-	 os_spi_send((addr >> 8) & 0xFF);
-	 os_spi_send(addr & 0xFF);
+
+// Writes a command and a 24bit memory address for the external SRAM into the header of a transfer.
+void transfer_address(SpiTransfer *transfer, uint8_t command, MemAddr addr){
+	transfer->device = &sramDevice;
+	transfer->header[0] = command;
+	transfer->header[1] = ((uint32_t)addr >> 16) & 0xFF;
+	transfer->header[2] = (addr >> 8) & 0xFF;
+	transfer->header[3] = addr & 0xFF;
+	transfer->headerLength = 4;
 }
 	
+#if SRAM_CACHE_LINES > 8
+#error "SRAM_CACHE_LINES must not exceed 8"
+#endif
+
+//! Returned by cacheBypass if the transfer may be queued
+#define CACHE_NO_LINE 0xFF
+
+#if SRAM_CACHE_LINES > 0
+//! Direct-mapped cache of the external SRAM, line i holds the bytes from sramCacheTags[i] on while bit i of sramCacheValid is set
+static MemValue sramCache[SRAM_CACHE_LINES][SRAM_CACHE_LINE_SIZE];
+static MemAddr sramCacheTags[SRAM_CACHE_LINES];
+static uint8_t sramCacheValid;
+//! Bit i is set while a transfer loads line i or writes it back, nobody but the process that queued it changes the line then
+static uint8_t sramCacheBusy;
+//! Bit i is set if bytes of line i were written to the external SRAM directly while it was busy, so it must not become valid
+static uint8_t sramCacheStale;
+#if SRAM_CACHE_WRITE_BACK
+//! Bit i is set while line i holds bytes that have not been written to the external SRAM yet
+static uint8_t sramCacheDirty;
+#endif
+static uint16_t sramCacheHits;
+static uint16_t sramCacheMisses;
+
+// Result of looking up a line in cacheAccess.
+typedef enum CacheState {
+	CACHE_HIT,      // the byte was read from or written to the line
+	CACHE_BUSY,     // the line is busy, the byte has to be transferred directly
+	CACHE_UNLOCKED, // the line has to be loaded, but sramMutex has not been asked for yet
+	CACHE_DIRTY,    // the line has to be written back before it is loaded with other bytes
+	CACHE_LOADING   // the line is being loaded
+} CacheState;
+#endif
+
 void initSRAM_external(void){
+#if SRAM_CACHE_LINES > 0
+	sramCacheValid = 0;
+	sramCacheBusy = 0;
+	sramCacheStale = 0;
+#if SRAM_CACHE_WRITE_BACK
+	sramCacheDirty = 0;
+#endif
+#endif
 	os_spi_init();
-	select_memory();
-	set_operation_mode(0);
-	deselect_memory();
+	os_spi_initDevice(&sramDevice);
+	// Sequential mode: the address is incremented after every byte for as long as the chip is selected.
+	// A transfer of a single byte works just like in byte mode.
+	set_operation_mode(0x40);
+}
+
+//! Held by the process that uses the external SRAM
+static Mutex sramMutex = MUTEX_INITIALIZER;
+
+//! Transfer of the process that uses the external SRAM
+static SpiTransfer sramTransfer = {.done = true};
+
+//! Bytes read for the process that uses the external SRAM before they are copied onto its stack
+static MemValue sramBounce[SRAM_BOUNCE_BUFFER];
+
+/* Reserves the external SRAM for the current process. Processes waiting for it sleep in the wait queue of
+ * sramMutex, so only processes that use the SRAM contend for it and the others are not slowed down.
+ * Nobody else can run within a critical section or with interrupts disabled, e.g. in the task manager,
+ * so the SRAM is used right away there and false is returned.
+ */
+static bool lockSRAM_external(void){
+	// The scheduler interrupt is only enabled outside of critical sections
+	if (!(SREG & (1 << 7)) || !(TIMSK2 & (1 << OCIE2A))) {
+		return false;
+	}
+	os_mutex_lock(&sramMutex);
+	return true;
+}
+
+#if SRAM_CACHE_LINES > 0
+/* The state of the cache is shared by all processes, so it is only looked at and changed with interrupts disabled.
+ * Lines are loaded and written back with interrupts enabled though. A line is busy meanwhile: it may still be read
+ * if it is valid, but everybody else transfers bytes that would have to change it directly. As a transfer is
+ * queued together with the change of the state it belongs to, the queue of the SPI bus keeps all of them in order.
+ */
+
+// Returns whether a line holds the bytes from the given tag on and may be read, interrupts have to be disabled.
+static bool cacheHolds(uint8_t line, MemAddr tag){
+	return (sramCacheValid & ~sramCacheStale & (1 << line)) && sramCacheTags[line] == tag;
+}
+
+// Queues the transfer that loads a line from or writes it back to the external SRAM, interrupts have to be disabled.
+static void cacheSubmit(SpiTransfer *transfer, uint8_t command, uint8_t line){
+	transfer_address(transfer, command, sramCacheTags[line]);
+	transfer->tx = (command == 0x02) ? sramCache[line] : NULL;
+	transfer->rx = (command == 0x03) ? sramCache[line] : NULL;
+	transfer->length = SRAM_CACHE_LINE_SIZE;
+	transfer->fill = 0xFF;
+	os_spi_submit(transfer);
+}
+
+// Ends the transfer of a busy line, which stays or becomes valid unless its bytes went stale meanwhile.
+static void cacheRelease(uint8_t line){
+	if (sramCacheStale & (1 << line)) {
+		sramCacheValid &= ~(1 << line);
+	} else {
+		sramCacheValid |= 1 << line;
+	}
+	sramCacheBusy &= ~(1 << line);
+	sramCacheStale &= ~(1 << line);
+}
+
+// Reads a byte from or writes it to a line that holds it, interrupts have to be disabled.
+static void cacheCopy(uint8_t line, MemAddr addr, MemValue *value, bool write){
+	if (write) {
+		sramCache[line][addr % SRAM_CACHE_LINE_SIZE] = *value;
+#if SRAM_CACHE_WRITE_BACK
+		sramCacheDirty |= 1 << line;
+#endif
+	} else {
+		*value = sramCache[line][addr % SRAM_CACHE_LINE_SIZE];
+	}
+}
+
+#if SRAM_CACHE_WRITE_BACK
+// Writes a modified line back to the external SRAM and waits for it.
+static void cacheClean(SpiTransfer *transfer, uint8_t line){
+	bool queued = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if ((sramCacheDirty & (1 << line)) && !(sramCacheBusy & (1 << line))) {
+			sramCacheDirty &= ~(1 << line);
+			sramCacheBusy |= 1 << line;
+			cacheSubmit(transfer, 0x02, line);
+			queued = true;
+		}
+	}
+	if (queued) {
+		os_spi_wait(transfer);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			cacheRelease(line);
+		}
+	}
+}
+#endif
+
+/* Reads a byte through the cache or, with SRAM_CACHE_WRITE_BACK, writes it. A missing line is loaded first
+ * by a process that holds sramMutex, unless nobody else can run anyway.
+ * Returns false if the line is busy, the byte has to be transferred directly then.
+ */
+static bool cacheAccess(MemAddr addr, MemValue *value, bool write){
+	uint8_t const line = (addr / SRAM_CACHE_LINE_SIZE) % SRAM_CACHE_LINES;
+	MemAddr const tag = addr & ~(MemAddr)(SRAM_CACHE_LINE_SIZE - 1);
+	SpiTransfer local;
+	SpiTransfer *transfer = NULL;
+	bool locked = false;
+	CacheState state = CACHE_BUSY;
+	do {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (cacheHolds(line, tag) && !(write && (sramCacheBusy & (1 << line)))) {
+				cacheCopy(line, addr, value, write);
+				sramCacheHits++;
+				state = CACHE_HIT;
+			} else if (sramCacheBusy & (1 << line)) {
+				sramCacheMisses++;
+				state = CACHE_BUSY;
+			} else if (transfer == NULL) {
+				state = CACHE_UNLOCKED;
+#if SRAM_CACHE_WRITE_BACK
+			} else if (sramCacheDirty & (1 << line)) {
+				state = CACHE_DIRTY;
+#endif
+			} else {
+				sramCacheMisses++;
+				sramCacheTags[line] = tag;
+				sramCacheValid &= ~(1 << line);
+				sramCacheStale &= ~(1 << line);
+				sramCacheBusy |= 1 << line;
+				cacheSubmit(transfer, 0x03, line);
+				state = CACHE_LOADING;
+			}
+		}
+		if (state == CACHE_UNLOCKED) {
+			// The mutex may have to be waited for, so the line is looked up again afterwards
+			locked = lockSRAM_external();
+			transfer = locked ? &sramTransfer : &local;
+#if SRAM_CACHE_WRITE_BACK
+		} else if (state == CACHE_DIRTY) {
+			cacheClean(transfer, line);
+#endif
+		} else if (state == CACHE_LOADING) {
+			os_spi_wait(transfer);
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				cacheRelease(line);
+				// A byte read from a stale line is still the one the SRAM held when the line was loaded
+				if (!write || (sramCacheValid & (1 << line))) {
+					cacheCopy(line, addr, value, write);
+					state = CACHE_HIT;
+				} else {
+					state = CACHE_BUSY;
+				}
+			}
+		}
+	} while (state != CACHE_HIT && state != CACHE_BUSY);
+	if (locked) {
+		os_mutex_unlock(&sramMutex);
+	}
+	return state == CACHE_HIT;
+}
+
+/* Brings the cache in line with a transfer of consecutive bytes that bypasses it, interrupts have to be disabled
+ * as the transfer has to be queued together with it. Cached copies of written bytes are updated and busy lines they
+ * belong to become stale. With SRAM_CACHE_WRITE_BACK, a line holding modified bytes that are about to be read is
+ * returned, as it has to be written back first. Otherwise CACHE_NO_LINE is returned.
+ */
+static uint8_t cacheBypass(uint8_t command, MemAddr addr, uint16_t length, MemValue const *src, MemValue fill){
+	for (uint8_t line = 0; line < SRAM_CACHE_LINES; line++) {
+		MemAddr const tag = sramCacheTags[line];
+		if (!((sramCacheValid | sramCacheBusy) & (1 << line))
+			|| ((MemAddr)(tag - addr) >= length && (MemAddr)(addr - tag) >= SRAM_CACHE_LINE_SIZE)) {
+			continue;
+		}
+		if (command == 0x03) {
+#if SRAM_CACHE_WRITE_BACK
+			if (sramCacheDirty & (1 << line)) {
+				return line;
+			}
+#endif
+		} else if (sramCacheBusy & (1 << line)) {
+			sramCacheStale |= 1 << line;
+		} else {
+			for (uint8_t i = 0; i < SRAM_CACHE_LINE_SIZE; i++) {
+				MemAddr const offset = tag + i - addr;
+				if (offset < length) {
+					sramCache[line][i] = src ? src[offset] : fill;
+				}
+			}
+		}
+	}
+	return CACHE_NO_LINE;
+}
+#endif
+
+// Fills in a transfer of consecutive bytes of the external SRAM, carries it out and waits for it.
+static void runSRAM_external(SpiTransfer *transfer, uint8_t command, MemAddr addr, MemValue const *src, MemValue *dest, uint16_t length, MemValue fill){
+	bool queued = false;
+	while (!queued) {
+		uint8_t dirty = CACHE_NO_LINE;
+		transfer_address(transfer, command, addr);
+		transfer->tx = src;
+		transfer->rx = dest;
+		transfer->length = length;
+		transfer->fill = fill;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#if SRAM_CACHE_LINES > 0
+			dirty = cacheBypass(command, addr, length, src, fill);
+#endif
+			if (dirty == CACHE_NO_LINE) {
+				os_spi_submit(transfer);
+				queued = true;
+			}
+		}
+#if SRAM_CACHE_LINES > 0 && SRAM_CACHE_WRITE_BACK
+		if (!queued) {
+			cacheClean(transfer, dirty);
+		}
+#endif
+	}
+	os_spi_wait(transfer);
+}
+
+/* Carries out a read or write command on consecutive bytes of the external SRAM and waits for it.
+ * Interrupts are only masked while the transfer is queued. The SRAM is fast enough to be polled, so os_spi_wait exchanges
+ * the bytes, and other processes keep running whenever the waiting one is switched out.
+ */
+static void transferSRAM_external(uint8_t command, MemAddr addr, MemValue const *src, MemValue *dest, uint16_t length, MemValue fill){
+	if (!lockSRAM_external()) {
+		// The caller keeps the processor until the transfer is done, so it may live on the stack
+		SpiTransfer transfer;
+		runSRAM_external(&transfer, command, addr, src, dest, length, fill);
+		return;
+	}
+	/* The process may be switched out while another process waiting for the bus carries out its transfer. Nobody
+	 * must write to its stack in the meantime as that would change the stack checksum, so the descriptor is kept here
+	 * and bytes that are read onto a process stack take a detour through sramBounce.
+	 */
+	if (dest && (uint16_t)dest > PROCESS_STACK_BOTTOM(MAX_NUMBER_OF_PROCESSES)) {
+		while (length > 0) {
+			uint16_t const piece = length < SRAM_BOUNCE_BUFFER ? length : SRAM_BOUNCE_BUFFER;
+			runSRAM_external(&sramTransfer, command, addr, src, sramBounce, piece, fill);
+			memcpy(dest, sramBounce, piece);
+			addr += piece;
+			dest += piece;
+			length -= piece;
+		}
+	} else {
+		runSRAM_external(&sramTransfer, command, addr, src, dest, length, fill);
+	}
+	os_mutex_unlock(&sramMutex);
+}
+
+/* Releases the external SRAM if the given process, which is about to be killed, holds it.
+ * Its transfer may still be reading from its stack, so it is finished first.
+ */
+void os_releaseMemoryDevices(uint8_t pid){
+	if (sramMutex.owner != pid) {
+		return;
+	}
+	os_spi_wait(&sramTransfer);
+#if SRAM_CACHE_LINES > 0
+	// Only the holder of sramMutex can be switched out while it loads or writes back a line, so every busy line is its own
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (uint8_t line = 0; line < SRAM_CACHE_LINES; line++) {
+			if (sramCacheBusy & (1 << line)) {
+				cacheRelease(line);
+			}
+		}
+	}
+#endif
+	os_mutex_abandon(&sramMutex, pid);
 }
 
 // Private function to read a single byte to the external SRAM It will not check if its call is valid.
 MemValue readSRAM_external(MemAddr addr){
-	os_enterCriticalSection();
-	select_memory();
-	os_spi_send(0x03);
-	transfer_address(addr);
-	MemValue data = os_spi_receive();
-	deselect_memory();
-	os_leaveCriticalSection();
+	MemValue data;
+#if SRAM_CACHE_LINES > 0
+	if (cacheAccess(addr, &data, false)) {
+		return data;
+	}
+#endif
+	transferSRAM_external(0x03, addr, NULL, &data, 1, 0xFF);
 	return data;
 }
 	
 // Private function to write a single byte to the external SRAM It will not check if its call is valid.	
 void writeSRAM_external(MemAddr addr, MemValue value){
-	os_enterCriticalSection();
-	select_memory();
-	os_spi_send(0x02);
-	transfer_address(addr);
-	os_spi_send(value);
-	deselect_memory();
-	os_leaveCriticalSection();
+#if SRAM_CACHE_LINES > 0 && SRAM_CACHE_WRITE_BACK
+	if (cacheAccess(addr, &value, true)) {
+		return;
+	}
+#endif
+	// Written through, the copy in the cache is updated when the transfer is queued
+	transferSRAM_external(0x02, addr, &value, NULL, 1, 0);
+}
+
+// Reads consecutive bytes from the external SRAM with a single command.
+void readBlockSRAM_external(MemAddr addr, MemValue *dest, uint16_t length){
+	transferSRAM_external(0x03, addr, NULL, dest, length, 0xFF);
+}
+
+// Writes consecutive bytes to the external SRAM with a single command.
+void writeBlockSRAM_external(MemAddr addr, MemValue const *src, uint16_t length){
+	transferSRAM_external(0x02, addr, src, NULL, length, 0);
+}
+
+// Writes the same value to consecutive bytes of the external SRAM with a single command.
+void fillSRAM_external(MemAddr addr, MemValue value, uint16_t length){
+	transferSRAM_external(0x02, addr, NULL, NULL, length, value);
 }	
 	
+// Reports how many single-byte accesses to the external SRAM were served by its cache and how many had to load a line.
+void os_getSRAMCacheStats(uint16_t *hits, uint16_t *misses){
+#if SRAM_CACHE_LINES > 0
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*hits = sramCacheHits;
+		*misses = sramCacheMisses;
+	}
+#else
+	*hits = 0;
+	*misses = 0;
+#endif
+}
+
+// Restarts counting the hits and misses of the cache of the external SRAM.
+void os_resetSRAMCacheStats(void){
+#if SRAM_CACHE_LINES > 0
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		sramCacheHits = 0;
+		sramCacheMisses = 0;
+	}
+#endif
+}
+
 // Function that needs to be called once in order to initialise all used memories such as the internal SRAM etc
 void initMemoryDevices(void){
 	initSRAM_internal();
@@ -89,5 +465,8 @@ void initMemoryDevices(void){
 MemDriver extSRAM__={
 	.init = &initSRAM_external,
 	.read = &readSRAM_external,
-	.write = &writeSRAM_external
+	.write = &writeSRAM_external,
+	.readBlock = &readBlockSRAM_external,
+	.writeBlock = &writeBlockSRAM_external,
+	.fill = &fillSRAM_external
 };	
\ No newline at end of file
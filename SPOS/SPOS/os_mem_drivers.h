@@ -4,12 +4,25 @@
 #include <inttypes.h>
 #include "defines.h"
 
+#if MEM_WIDE_ADDRESSES && defined(__UINT24_MAX__)
+// avr-gcc has a native 24 bit integer, it covers the chip and takes a byte less of internal SRAM in every table of the heaps
+typedef __uint24 MemAddr;
+typedef __uint24 MemSize;
+#elif MEM_WIDE_ADDRESSES
+typedef uint32_t MemAddr;
+typedef uint32_t MemSize;
+#else
 typedef uint16_t MemAddr;
+typedef uint16_t MemSize; // number of bytes within a memory, as wide as MemAddr
+#endif
 typedef uint8_t MemValue;
 
 typedef void MemoryInitHnd(void);
 typedef MemValue MemoryReadHnd(MemAddr addr);
 typedef void MemoryWriteHnd(MemAddr addr, MemValue value);
+typedef void MemoryReadBlockHnd(MemAddr addr, MemValue *dest, uint16_t length);
+typedef void MemoryWriteBlockHnd(MemAddr addr, MemValue const *src, uint16_t length);
+typedef void MemoryFillHnd(MemAddr addr, MemValue value, uint16_t length);
 
 typedef struct MemDriver {
 	// Constants for the characteristics of the memory medium
@@ -18,6 +31,10 @@ typedef struct MemDriver {
 	MemoryInitHnd *init;
 	MemoryReadHnd *read;
 	MemoryWriteHnd *write;
+	// Access routines for consecutive addresses, they are much faster than a loop over read/write on serial memories
+	MemoryReadBlockHnd *readBlock;
+	MemoryWriteBlockHnd *writeBlock;
+	MemoryFillHnd *fill;
 } MemDriver;
 
 extern MemDriver intSRAM__;
@@ -27,4 +44,13 @@ extern MemDriver extSRAM__;
 
 void initMemoryDevices(void);
 
+//! Releases the memory devices that are held by a process which is killed
+void os_releaseMemoryDevices(uint8_t pid);
+
+//! Reports the hits and misses of the cache of the external SRAM, the counters wrap around
+void os_getSRAMCacheStats(uint16_t *hits, uint16_t *misses);
+
+//! Restarts counting the hits and misses of the cache of the external SRAM
+void os_resetSRAMCacheStats(void);
+
 #endif
\ No newline at end of file
@@ -1,65 +1,348 @@
 #include "os_memheap_drivers.h"
 #include "defines.h"
 #include "os_memory_strategies.h"
+#include "os_memory.h"
+#include "os_scheduler.h"
+#include "os_core.h"
 #include <avr/pgmspace.h>
 
+// Log2 of the number of use bytes every map entry of a heap stands for, from 0 (1 byte) to 4 (16 bytes).
+// Allocations are rounded up to that many bytes, in turn the map shrinks and scans read fewer entries.
+// By default every entry stands for a single byte, so chunks have exactly the requested size.
+#ifndef INTERNAL_GRANULARITY_SHIFT
+#define INTERNAL_GRANULARITY_SHIFT 0
+#endif
+#ifndef EXTERNAL_GRANULARITY_SHIFT
+#if MEM_WIDE_ADDRESSES
+#define EXTERNAL_GRANULARITY_SHIFT 1
+#else
+#define EXTERNAL_GRANULARITY_SHIFT 0
+#endif
+#endif
+
+#if INTERNAL_GRANULARITY_SHIFT > 4 || EXTERNAL_GRANULARITY_SHIFT > 4
+#error "A map entry stands for at most 16 bytes"
+#endif
+
+#if MEM_WIDE_ADDRESSES && EXTERNAL_GRANULARITY_SHIFT == 0
+#error "The map entries of all 128 KiB do not fit into the 16 bit page numbers of the task manager"
+#endif
+
+// Every map byte holds two entries, so it stands for this many use bytes.
+#define MAPBYTE_USE(SHIFT) (2u << (SHIFT))
+
+// Bytes of the 23LC1024 the external heap can address, 16 bit addresses only reach the lower half
+#if MEM_WIDE_ADDRESSES
+#define EXTERNAL_MEMORY_SIZE 131072ul
+#else
+#define EXTERNAL_MEMORY_SIZE 65536ul
+#endif
+
+/* 1 keeps the map of the external heap in internal SRAM, so its allocations and frees do not wait for the SPI bus.
+ * The external heap then covers EXTERNAL_INTERNAL_USESIZE bytes of the chip and its map is sized from them: every map
+ * byte stands for 2^(EXTERNAL_GRANULARITY_SHIFT + 1) use bytes, e.g. 8 KiB take 256 bytes with a granularity of 16 bytes.
+ * The map is taken from the end of the internal heap, which shrinks accordingly.
+ * With the map on the chip, the map summary of the external heap (EXTERNAL_SUMMARY_SHIFT) still lives in internal SRAM,
+ * so scans skip full and empty blocks without using the bus.
+ */
+#ifndef EXTERNAL_MAP_INTERNAL
+#define EXTERNAL_MAP_INTERNAL 0
+#endif
+#ifndef EXTERNAL_INTERNAL_USESIZE
+#define EXTERNAL_INTERNAL_USESIZE 8192ul
+#endif
+
+#if EXTERNAL_MAP_INTERNAL
+#define EXTERNAL_INTERNAL_MAPSIZE (EXTERNAL_INTERNAL_USESIZE >> (EXTERNAL_GRANULARITY_SHIFT + 1))
+#else
+#define EXTERNAL_INTERNAL_MAPSIZE 0
+#endif
+
+/* Log2 of the size of the blocks of the chunk table of a heap, 0 leaves the heap with OS_LAYOUT_MAP.
+ * The table is stored behind the use area and takes CHUNK_TABLE_ENTRY bytes per block, so the external heap
+ * gives up 1/16 of a byte per use byte (1/21 with MEM_WIDE_ADDRESSES), about 1.7 KiB of 43 KiB.
+ */
+#define INTERNAL_TAG_SHIFT 0
+#if MEM_WIDE_ADDRESSES
+#define EXTERNAL_TAG_SHIFT 7
+#else
+#define EXTERNAL_TAG_SHIFT 6
+#endif
+
+#if (INTERNAL_TAG_SHIFT > 0 && INTERNAL_TAG_SHIFT <= INTERNAL_GRANULARITY_SHIFT) || (EXTERNAL_TAG_SHIFT > 0 && EXTERNAL_TAG_SHIFT <= EXTERNAL_GRANULARITY_SHIFT)
+#error "The blocks of the chunk table must hold at least two map entries"
+#endif
+
+// Number of map bytes of a heap that gets the given number of bytes for its map, its use area and its chunk table.
+#define FIT_MAPSIZE(BYTES, SHIFT, TAGSHIFT) ((TAGSHIFT) == 0 ? (BYTES) / (1 + MAPBYTE_USE(SHIFT)) \
+	: ((BYTES) - CHUNK_TABLE_ENTRY) * (1ul << (TAGSHIFT)) / ((1 + MAPBYTE_USE(SHIFT)) * (1ul << (TAGSHIFT)) + CHUNK_TABLE_ENTRY * MAPBYTE_USE(SHIFT)))
+
+#if EXTERNAL_MAP_INTERNAL && 0x100 + EXTERNAL_INTERNAL_USESIZE > EXTERNAL_MEMORY_SIZE
+#error "The external heap does not fit into the external SRAM"
+#endif
+
+#if EXTERNAL_MAP_INTERNAL && EXTERNAL_INTERNAL_MAPSIZE > ((0x10FF - 0x100) / 2 - HEAPOFFSET) / 2
+#error "The map of the external heap takes more than half of the internal heap, raise EXTERNAL_GRANULARITY_SHIFT or lower EXTERNAL_INTERNAL_USESIZE"
+#endif
+
 #define MAPSTART HEAPOFFSET + 0x100
-#define MAPSIZE ((0x10FF - 0x100) / 2 - HEAPOFFSET)/3
+#define MAPSIZE FIT_MAPSIZE((0x10FF - 0x100) / 2 - HEAPOFFSET - EXTERNAL_INTERNAL_MAPSIZE, INTERNAL_GRANULARITY_SHIFT, INTERNAL_TAG_SHIFT)
+#define USESIZE (MAPSIZE * MAPBYTE_USE(INTERNAL_GRANULARITY_SHIFT))
+#define INTERNAL_TAGSTART (MAPSTART + MAPSIZE + USESIZE)
 
+#if EXTERNAL_MAP_INTERNAL
+#define EXTERNAL_MAPDRIVER intSRAM
+#define EXTERNAL_MAPSTART (INTERNAL_TAGSTART + CHUNK_TABLE_BYTES(USESIZE, INTERNAL_TAG_SHIFT)) // right behind the internal heap
+#define EXTERNAL_MAPSIZE EXTERNAL_INTERNAL_MAPSIZE
+#define EXTERNAL_USESTART 0x100 // address 0 would look like a failed allocation
+#else
+#define EXTERNAL_MAPDRIVER extSRAM
 #define EXTERNAL_MAPSTART 0
-#define EXTERNAL_MAPSIZE 21845 // 64*1024/3 = 21845.333
+#define EXTERNAL_MAPSIZE (MemSize)FIT_MAPSIZE(EXTERNAL_MEMORY_SIZE, EXTERNAL_GRANULARITY_SHIFT, EXTERNAL_TAG_SHIFT) // 20970 for single bytes of 64 KiB
+#define EXTERNAL_USESTART (EXTERNAL_MAPSTART + EXTERNAL_MAPSIZE)
+#endif
+#define EXTERNAL_USESIZE (MemSize)((uint32_t)EXTERNAL_MAPSIZE * MAPBYTE_USE(EXTERNAL_GRANULARITY_SHIFT))
+#define EXTERNAL_TAGSTART (EXTERNAL_USESTART + EXTERNAL_USESIZE)
+
+// Size of the smallest blocks of the buddy strategy as a power of two, 0 disables the buddy strategy on that heap.
+// The use area of a heap must not hold more than 255 of these blocks.
+#define INTERNAL_BUDDY_SHIFT 4
+#if MEM_WIDE_ADDRESSES
+#define EXTERNAL_BUDDY_SHIFT 9
+#else
+#define EXTERNAL_BUDDY_SHIFT 8
+#endif
+
+// Number of first-level classes of the TLSF strategy, 0 disables the TLSF strategy on that heap.
+// Class f holds the free blocks of 2^(f+3) up to 2^(f+4)-1 bytes, so the classes have to cover the use area.
+// With MEM_WIDE_ADDRESSES the smallest class starts at 2^4 bytes, so the same number of classes covers twice as much.
+#define INTERNAL_TLSF_CLASSES 7
+#define EXTERNAL_TLSF_CLASSES 13
+
+// Log2 of the size of the blocks the map summary of a heap is kept for, 0 disables the summary on that heap.
+#define INTERNAL_SUMMARY_SHIFT 5
+#if MEM_WIDE_ADDRESSES
+#define EXTERNAL_SUMMARY_SHIFT 9
+#else
+#define EXTERNAL_SUMMARY_SHIFT 8
+#endif
+
+#if (INTERNAL_SUMMARY_SHIFT > 0 && INTERNAL_SUMMARY_SHIFT < INTERNAL_GRANULARITY_SHIFT) || (EXTERNAL_SUMMARY_SHIFT > 0 && EXTERNAL_SUMMARY_SHIFT < EXTERNAL_GRANULARITY_SHIFT)
+#error "The blocks of the map summary must not be smaller than a map entry"
+#endif
+
+#if INTERNAL_SUMMARY_SHIFT > 0
+uint8_t intSummaryBits[2 * SUMMARY_BYTES(USESIZE, INTERNAL_SUMMARY_SHIFT)];
+#else
+#define intSummaryBits NULL
+#endif
+
+#if EXTERNAL_SUMMARY_SHIFT > 0
+uint8_t extSummaryBits[2 * SUMMARY_BYTES(EXTERNAL_USESIZE, EXTERNAL_SUMMARY_SHIFT)];
+#else
+#define extSummaryBits NULL
+#endif
+
+// Log2 of the size of the blocks every process notes its private chunks in, 0 makes the cleanup of a process scan the whole map of that heap.
+#define INTERNAL_OWNER_SHIFT 5
+#if MEM_WIDE_ADDRESSES
+#define EXTERNAL_OWNER_SHIFT 11
+#else
+#define EXTERNAL_OWNER_SHIFT 10
+#endif
+
+#if (INTERNAL_OWNER_SHIFT > 0 && INTERNAL_OWNER_SHIFT < INTERNAL_GRANULARITY_SHIFT) || (EXTERNAL_OWNER_SHIFT > 0 && EXTERNAL_OWNER_SHIFT < EXTERNAL_GRANULARITY_SHIFT)
+#error "The owner blocks must not be smaller than a map entry"
+#endif
+
+#if INTERNAL_OWNER_SHIFT > 0
+uint8_t intOwnerBits[(MAX_NUMBER_OF_PROCESSES - 1) * SUMMARY_BYTES(USESIZE, INTERNAL_OWNER_SHIFT)];
+#else
+#define intOwnerBits NULL
+#endif
+
+#if EXTERNAL_OWNER_SHIFT > 0
+uint8_t extOwnerBits[(MAX_NUMBER_OF_PROCESSES - 1) * SUMMARY_BYTES(EXTERNAL_USESIZE, EXTERNAL_OWNER_SHIFT)];
+#else
+#define extOwnerBits NULL
+#endif
+
+#if (INTERNAL_BUDDY_SHIFT > 0 && INTERNAL_BUDDY_SHIFT < INTERNAL_GRANULARITY_SHIFT) || (EXTERNAL_BUDDY_SHIFT > 0 && EXTERNAL_BUDDY_SHIFT < EXTERNAL_GRANULARITY_SHIFT)
+#error "The smallest buddy blocks must not be smaller than a map entry"
+#endif
+
+#if INTERNAL_BUDDY_SHIFT > 0
+#define INTERNAL_BUDDY_LEAVES (USESIZE >> INTERNAL_BUDDY_SHIFT)
+#else
+#define INTERNAL_BUDDY_LEAVES 0
+#endif
+
+#if EXTERNAL_BUDDY_SHIFT > 0
+#define EXTERNAL_BUDDY_LEAVES (EXTERNAL_USESIZE >> EXTERNAL_BUDDY_SHIFT)
+#else
+#define EXTERNAL_BUDDY_LEAVES 0
+#endif
+
+// The buddy tree and the TLSF free lists of a heap share their memory as only the current strategy of a heap uses it
+#define STRATEGY_DATA_SIZE(LEAVES, CLASSES) \
+	((2 * BUDDY_TREE_BYTES(LEAVES) > (CLASSES) * TLSF_LISTS_PER_CLASS * sizeof(MemAddr)) \
+	? 2 * BUDDY_TREE_BYTES(LEAVES) : (CLASSES) * TLSF_LISTS_PER_CLASS * sizeof(MemAddr))
+
+#if INTERNAL_BUDDY_SHIFT > 0 || INTERNAL_TLSF_CLASSES > 0
+uint8_t intStrategyData[STRATEGY_DATA_SIZE(INTERNAL_BUDDY_LEAVES, INTERNAL_TLSF_CLASSES)];
+#else
+#define intStrategyData NULL
+#endif
+
+#if EXTERNAL_BUDDY_SHIFT > 0 || EXTERNAL_TLSF_CLASSES > 0
+uint8_t extStrategyData[STRATEGY_DATA_SIZE(EXTERNAL_BUDDY_LEAVES, EXTERNAL_TLSF_CLASSES)];
+#else
+#define extStrategyData NULL
+#endif
 
 Heap intHeap__ =
 {
 	.driver = intSRAM,
+	.mapDriver = intSRAM,
 	.mapSize = MAPSIZE,
 	.mapStart = MAPSTART,
 	.name = "intHeap",
 	.strategy = OS_MEM_FIRST,
-	.useSize = MAPSIZE + MAPSIZE,
+	.useSize = USESIZE,
+	.granularityShift = INTERNAL_GRANULARITY_SHIFT,
 	.useStart= MAPSTART + MAPSIZE,
+	.layout = INTERNAL_TAG_SHIFT ? OS_LAYOUT_TAGGED : OS_LAYOUT_MAP,
+	.tags = {
+		.shift = INTERNAL_TAG_SHIFT,
+		.start = INTERNAL_TAGSTART,
+	},
+	.buddy = {
+		.blockShift = INTERNAL_BUDDY_SHIFT,
+		.leafCount = INTERNAL_BUDDY_LEAVES,
+		.freeBits = intStrategyData,
+		.splitBits = intStrategyData + BUDDY_TREE_BYTES(INTERNAL_BUDDY_LEAVES),
+	},
+	.tlsf = {
+		.classCount = INTERNAL_TLSF_CLASSES,
+		.heads = (MemAddr*)intStrategyData,
+	},
+	.summary = {
+		.shift = INTERNAL_SUMMARY_SHIFT,
+		.emptyBits = intSummaryBits,
+		.fullBits = intSummaryBits + SUMMARY_BYTES(USESIZE, INTERNAL_SUMMARY_SHIFT),
+	},
+	.owners = {
+		.shift = INTERNAL_OWNER_SHIFT,
+		.bits = intOwnerBits,
+	},
 };
 
 Heap extHeap__ =
 {
 	.driver = extSRAM,
+	.mapDriver = EXTERNAL_MAPDRIVER,
 	.mapSize = EXTERNAL_MAPSIZE,
 	.mapStart = EXTERNAL_MAPSTART,
 	.name = "extHeap",
 	.strategy = OS_MEM_FIRST,
-	.useSize = (uint16_t)EXTERNAL_MAPSIZE*2,
-	.useStart= (uint16_t)EXTERNAL_MAPSTART + EXTERNAL_MAPSIZE
+	.useSize = EXTERNAL_USESIZE,
+	.granularityShift = EXTERNAL_GRANULARITY_SHIFT,
+	.useStart= EXTERNAL_USESTART,
+	.layout = EXTERNAL_TAG_SHIFT ? OS_LAYOUT_TAGGED : OS_LAYOUT_MAP,
+	.tags = {
+		.shift = EXTERNAL_TAG_SHIFT,
+		.start = EXTERNAL_TAGSTART,
+	},
+	.buddy = {
+		.blockShift = EXTERNAL_BUDDY_SHIFT,
+		.leafCount = EXTERNAL_BUDDY_LEAVES,
+		.freeBits = extStrategyData,
+		.splitBits = extStrategyData + BUDDY_TREE_BYTES(EXTERNAL_BUDDY_LEAVES),
+	},
+	.tlsf = {
+		.classCount = EXTERNAL_TLSF_CLASSES,
+		.heads = (MemAddr*)extStrategyData,
+	},
+	.summary = {
+		.shift = EXTERNAL_SUMMARY_SHIFT,
+		.emptyBits = extSummaryBits,
+		.fullBits = extSummaryBits + SUMMARY_BYTES(EXTERNAL_USESIZE, EXTERNAL_SUMMARY_SHIFT),
+	},
+	.owners = {
+		.shift = EXTERNAL_OWNER_SHIFT,
+		.bits = extOwnerBits,
+	},
 };
 
-void os_initHeaps () {
-	MemAddr mapAddress;
-	for(mapAddress = intHeap__.mapStart; mapAddress<intHeap__.mapStart +intHeap__.mapSize; mapAddress++) {
-		intHeap__.driver->write(mapAddress, 0b00000000);
-	}
-	for(mapAddress = extHeap__.mapStart; mapAddress<extHeap__.mapStart +extHeap__.mapSize; mapAddress++) {
-		extHeap__.driver->write(mapAddress, 0b00000000);
+// Clears the map of a heap and resets its bookkeeping.
+static void initHeap(Heap *heap) {
+	heap->mapDriver->fill(heap->mapStart, 0b00000000, heap->mapSize);
+	heap->lastAddr = 0;
+	os_resetOwnerBlocks(heap);
+	heap->freeExtentTotal = 1;
+	for (uint8_t i = 0; i < MAX_NUMBER_OF_PROCESSES; i++)
+	{
+		heap->ownerBytes[i] = 0;
 	}
-	intHeap__.lastAddr = 0;
-	extHeap__.lastAddr = 0;
-	// Optimierung
-	for (uint8_t i = 1; i < MAX_NUMBER_OF_PROCESSES; i++)
+	heap->highWater = 0;
+	heap->largestFree = heap->useSize;
+	heap->largestFreeStale = false;
+	os_resetMapSummary(heap);
+	// The whole use area is one free extent after the map was cleared
+	os_rebuildFreeExtents(heap);
+	for (uint8_t i = 0; i < HEAP_HANDLES; i++)
 	{
-		intHeap__.allocFrameStart[i] = 0;
-		intHeap__.allocFrameEnd[i] = 0;
-		extHeap__.allocFrameStart[i] = 0;
-		extHeap__.allocFrameEnd[i] = 0;
+		heap->handles[i].addr = 0;
+	}
+	heap->compaction.handle = 0;
+	os_Memory_ResetStrategy(heap);
+}
+
+// Registered heaps in the order of their registration, os_initHeaps registers the internal and the external heap first.
+static Heap* heapList[MAX_NUMBER_OF_HEAPS];
+static uint8_t heapListLength;
+
+void os_initHeaps () {
+	os_registerHeap(intHeap);
+	os_registerHeap(extHeap);
+}
+
+/* Clears the map of a heap, resets its bookkeeping and adds it to the heaps that os_kill, the idle process and the task manager work on.
+ * Besides the drivers, the map and the use area, the heap only needs a name, a strategy and a granularity. Tables it has no memory
+ * for stay NULL with a capacity of 0, which disables the buddy and TLSF strategies and the map summary on it. A heap without
+ * owner blocks is cleaned up by scanning its whole map, and OS_LAYOUT_TAGGED needs a chunk table behind the use area.
+ * The map, the use area and the chunk table must not overlap with those of another heap. Returns false if the heap cannot be registered.
+ */
+bool os_registerHeap(Heap *heap) {
+	if (((uint32_t)heap->mapSize * 2 << heap->granularityShift) < heap->useSize) {
+		os_error("heap map too small");
+		return false;
+	}
+	bool registered = false;
+	os_enterCriticalSection();
+	if (heapListLength < MAX_NUMBER_OF_HEAPS) {
+		registered = true;
+		for (uint8_t i = 0; i < heapListLength; i++) {
+			if (heapList[i] == heap) {
+				registered = false;
+			}
+		}
+		if (registered) {
+			initHeap(heap);
+			heapList[heapListLength++] = heap;
+		}
 	}
+	os_leaveCriticalSection();
+	return registered;
 }
 
 size_t os_getHeapListLength(void) {
-	return 2;
+	return heapListLength;
 }
 
 Heap* os_lookupHeap(uint8_t index) {
-	if (index == 0) {
-		return intHeap;
-	}else if (index == 1) {
-		return extHeap;	
+	if (index < heapListLength) {
+		return heapList[index];
 	}else {
 		return NULL;
 	}
@@ -3,27 +3,196 @@
 
 #include "os_mem_drivers.h"
 #include <stddef.h>
+#include <stdbool.h>
 
 typedef enum AllocStrategy
 {
 	OS_MEM_FIRST,
 	OS_MEM_NEXT,
 	OS_MEM_BEST,
-	OS_MEM_WORST
+	OS_MEM_WORST,
+	OS_MEM_SLAB,
+	OS_MEM_BUDDY,
+	OS_MEM_TLSF
 } AllocStrategy;
 
+// A contiguous range of bytes in the use area of a heap.
+typedef struct MemRange {
+	MemAddr start;
+	MemSize length;
+} MemRange;
+
+// A contiguous run of free bytes in the use area of a heap.
+typedef MemRange FreeExtent;
+
+// Number of bytes of an address or a size that a heap stores in its own use area, e.g. in the nodes of its free-extent list
+#if MEM_WIDE_ADDRESSES
+#define HEAP_FIELD_SIZE 3 // 24 bits cover the whole external SRAM
+#else
+#define HEAP_FIELD_SIZE 2
+#endif
+
+// Size of a node of the free-extent list, free ranges that are shorter are fragments and not listed
+#define HEAP_EXTENT_NODE (2 * HEAP_FIELD_SIZE)
+
+// How a heap describes its chunks.
+typedef enum HeapLayout {
+	OS_LAYOUT_MAP,     // chunks are described by the nibble map only
+	OS_LAYOUT_TAGGED   // chunks reaching over the start of a block are also described by the chunk table of the heap
+} HeapLayout;
+
+/* Chunk table of a heap (OS_LAYOUT_TAGGED only), stored in the memory of the heap behind its map and its use area.
+ * The use area is split into blocks of 2^shift bytes. Entry b holds the start and the length of the chunk that covers
+ * the first byte of block b, every other chunk starts and ends within one block. The start and the size of a chunk are
+ * thus found from the map entries of a single block and at most one entry, no matter how large the chunk is.
+ * The entries of blocks whose first byte is free are left as they are.
+ */
+typedef struct ChunkTable {
+	uint8_t shift;
+	MemAddr start; // address of entry 0
+} ChunkTable;
+
+// Number of bytes of an entry of a chunk table and of the chunk table of a use area of the given size.
+#define CHUNK_TABLE_ENTRY (2 * HEAP_FIELD_SIZE)
+#define CHUNK_TABLE_BYTES(USESIZE, SHIFT) ((((uint32_t)(USESIZE) + (1ul << (SHIFT)) - 1) >> (SHIFT)) * CHUNK_TABLE_ENTRY)
+
+// State of the free-extent list of a heap.
+typedef enum FreeIndexState {
+	HEAP_INDEX_VALID,    // the list matches the map
+	HEAP_INDEX_STALE,    // the list has to be rebuilt from the map before it is used
+	HEAP_INDEX_SUSPENDED // the free memory holds the lists of the TLSF strategy, the map is scanned instead
+} FreeIndexState;
+
+// Number of slots every slab is carved into, one bit of Slab.freeSlots per slot.
+#define HEAP_SLAB_SLOTS 16
+
+// A range of the use area that is split into equally sized slots for small requests (OS_MEM_SLAB only).
+typedef struct Slab {
+	MemAddr start;      // 0 if the slab is unused
+	uint8_t slotSize;   // a power of two no greater than HEAP_SLAB_MAX_SIZE
+	uint16_t freeSlots; // bit i is set iff slot i is free
+} Slab;
+
+// Maximum number of levels of a buddy tree, which allows for at most 255 smallest blocks.
+#define HEAP_BUDDY_LEVELS 8
+
+// Number of bytes needed to store one bit per block of a buddy tree with the given number of smallest blocks.
+#define BUDDY_TREE_BYTES(LEAVES) (((LEAVES) + (LEAVES) / 2 + (LEAVES) / 4 + (LEAVES) / 8 + (LEAVES) / 16 + (LEAVES) / 32 + (LEAVES) / 64 + (LEAVES) / 128 + 7) / 8)
+
+// Number of bytes of the summary of the free bits of a buddy tree, one bit per byte of the free bits of 255 smallest blocks.
+#define HEAP_BUDDY_SUMMARY ((BUDDY_TREE_BYTES(255) + 7) / 8)
+
+/* Bookkeeping of the buddy strategy, kept in internal SRAM (OS_MEM_BUDDY only).
+ * Level k of the tree holds the blocks made of (1 << k) smallest blocks. The bits of all
+ * levels are stored one after another, starting with the smallest blocks on level 0.
+ */
+typedef struct BuddyTree {
+	uint8_t blockShift;  // log2 of the size of the smallest blocks, 0 if the heap has no buddy tree
+	uint8_t leafCount;   // number of smallest blocks in the use area
+	uint8_t* freeBits;   // set iff the block is free
+	uint8_t* splitBits;  // set iff the block is split, on level 0 set iff the block holds chunks of another strategy
+	uint8_t freeCount[HEAP_BUDDY_LEVELS];
+	uint8_t freeSummary[HEAP_BUDDY_SUMMARY]; // bit b is set iff byte b of freeBits is not 0
+	uint8_t freeTop;                         // bit s is set iff byte s of freeSummary is not 0
+} BuddyTree;
+
+// Number of bytes needed for one bit per block of 2^SHIFT bytes of a use area of the given size.
+#define SUMMARY_BYTES(USESIZE, SHIFT) (((((uint32_t)(USESIZE) + (1ul << (SHIFT)) - 1) >> (SHIFT)) + 7) / 8)
+
+/* Summary of the map, kept in internal SRAM. The use area is split into blocks of 2^shift bytes.
+ * Bit b of fullBits is set iff every byte of block b is allocated, bit b of emptyBits iff every byte is free.
+ * Map scans skip blocks whose bit tells that they hold no matching entry.
+ */
+typedef struct MapSummary {
+	uint8_t shift;       // log2 of the block size, 0 if the heap has no summary
+	uint8_t* emptyBits;
+	uint8_t* fullBits;
+} MapSummary;
+
+// Log2 of the number of second-level classes every first-level class of the TLSF strategy is split into.
+#define TLSF_SL_BITS 2
+#define TLSF_LISTS_PER_CLASS (1 << TLSF_SL_BITS)
+
+// Maximum number of first-level classes of the TLSF strategy, enough for free blocks of up to 64 KiB (128 KiB with MEM_WIDE_ADDRESSES).
+#define HEAP_TLSF_CLASSES 13
+
+// Segregated free lists of the TLSF strategy, kept in internal SRAM (OS_MEM_TLSF only).
+typedef struct TlsfIndex {
+	uint8_t classCount;                    // number of first-level classes, 0 if the heap has no TLSF index
+	uint16_t classBitmap;                  // bit f is set iff a free list of first-level class f is not empty
+	uint8_t listBitmap[HEAP_TLSF_CLASSES]; // bit s of entry f is set iff free list s of first-level class f is not empty
+	MemAddr* heads;                        // first free block of every free list, 0 if the list is empty
+} TlsfIndex;
+
+// Index + 1 of an entry of the handle table of a heap, 0 is no handle.
+typedef uint8_t MemHandle;
+
+// A relocatable chunk, its address may only be used while the chunk is open.
+typedef struct HandleEntry {
+	MemAddr addr;      // 0 if the entry is unused
+	uint8_t openCount; // number of open access windows, the chunk is not moved while this is not 0
+} HandleEntry;
+
+// A relocatable chunk that os_compactHeap is sliding down in steps.
+typedef struct Compaction {
+	MemHandle handle;  // 0 if no chunk is being moved
+	MemAddr to;        // new start of the chunk
+	MemSize size;      // size of the chunk
+	MemSize done;      // number of bytes already copied
+} Compaction;
+
+/* Blocks of the use area that hold private chunks of a process, kept in internal SRAM. The use area is split into blocks of 2^shift bytes
+ * and every process other than the idle process has a row of SUMMARY_BYTES(useSize, shift) bytes. Bit b of row pid - 1 is set when a chunk
+ * of process pid is placed in block b and only cleared when the process is cleaned up, so os_freeProcessMemory only scans those blocks.
+ */
+typedef struct OwnerBlocks {
+	uint8_t shift; // log2 of the block size, 0 if the heap keeps no rows and the whole map is scanned instead
+	uint8_t* bits;
+} OwnerBlocks;
+
+// Usage of a heap as reported by os_getHeapStats.
+typedef struct HeapStats {
+	MemSize freeBytes;
+	MemSize ownerBytes[MAX_NUMBER_OF_PROCESSES]; // used bytes of every process, entry 0 holds the shared chunks
+	MemSize highWater;                          // maximum number of used bytes since the heap was initialised
+	uint16_t freeExtentCount;
+	MemSize largestFreeExtent;
+	uint8_t fragmentation;                      // percentage of the free bytes outside of the largest free extent
+} HeapStats;
+
 typedef struct Heap{
 	MemDriver* driver;
+	MemDriver* mapDriver; // memory that holds the map, it may differ from the one of the use area
 	MemAddr mapStart;
-	size_t mapSize;
+	MemSize mapSize;
 	MemAddr useStart;
-	size_t useSize;
+	MemSize useSize;
+	uint8_t granularityShift; // log2 of the number of use bytes every map entry stands for, at most 4
 	AllocStrategy strategy;
 	const char* name;
 	MemAddr lastAddr;
-	// Optimierung
-	MemAddr allocFrameStart[MAX_NUMBER_OF_PROCESSES];
-	MemAddr allocFrameEnd[MAX_NUMBER_OF_PROCESSES];
+	// List of the free extents of the use area sorted by their start address, its nodes are stored in the free memory itself
+	MemAddr freeHead;         // first listed extent, 0 if there is none
+	MemAddr freeCursor;       // listed extent the last search stopped at, 0 if the next one starts at the head
+	MemAddr freeCursorBefore; // listed extent in front of freeCursor, 0 if there is none
+	FreeIndexState freeIndexState;
+	HeapLayout layout;
+	ChunkTable tags;
+	// Slabs of the slab strategy, they are dissolved whenever the strategy changes
+	Slab slabs[HEAP_SLABS];
+	BuddyTree buddy;
+	TlsfIndex tlsf;
+	MapSummary summary;
+	// Relocatable chunks (see os_h_malloc) and the one being moved by os_compactHeap
+	HandleEntry handles[HEAP_HANDLES];
+	Compaction compaction;
+	OwnerBlocks owners;
+	// Statistics kept up to date by every allocation and release, entry 0 of ownerBytes counts the shared chunks
+	MemSize ownerBytes[MAX_NUMBER_OF_PROCESSES];
+	MemSize highWater;
+	uint16_t freeExtentTotal;
+	MemSize largestFree;   // length of the largest free extent unless largestFreeStale is set
+	bool largestFreeStale; // set when the largest free extent was cut and has to be searched for
 } Heap;
 
 extern Heap intHeap__;
@@ -33,6 +202,8 @@ extern Heap extHeap__;
 
 void os_initHeaps(void);
 
+bool os_registerHeap(Heap *heap);
+
 size_t os_getHeapListLength(void);
 
 Heap* os_lookupHeap(uint8_t index);
@@ -2,58 +2,965 @@
 #include "os_memory_strategies.h"
 #include "util.h"
 #include "os_core.h"
+#include "os_sync.h"
+
+// Processes waiting for a shared chunk to be closed. A process closing any shared chunk wakes up all of them.
+static ProcessQueue sharedWaiters = { .size = MAX_NUMBER_OF_PROCESSES };
 
 // Writes a value from 0x0 to 0xF to the lower nibble of the given address.
 void setLowNibble(Heap const *heap, MemAddr addr, MemValue value){
-	MemValue temp = heap->driver->read(addr);
+	MemValue temp = heap->mapDriver->read(addr);
 	temp &= 0b11110000;
 	temp |= value;
-	heap->driver->write(addr, temp);
+	heap->mapDriver->write(addr, temp);
 }
 
 // Writes a value from 0x0 to 0xF to the higher nibble of the given address.
 void setHighNibble(Heap const *heap, MemAddr addr, MemValue value){
-	MemValue temp = heap->driver->read(addr);
+	MemValue temp = heap->mapDriver->read(addr);
 	temp &= 0b00001111;
 	temp |= (value << 4);
-	heap->driver->write(addr, temp);
+	heap->mapDriver->write(addr, temp);
+}
+
+// Reads the value of the lower nibble of the given address.
+MemValue getLowNibble (Heap const *heap, MemAddr addr){
+	return (heap->mapDriver->read(addr) & 0b00001111);
+}
+
+// Reads the value of the higher nibble of the given address.
+MemValue getHighNibble (Heap const *heap, MemAddr addr){
+	return (heap->mapDriver->read(addr) >> 4);
+}
+
+static void summaryUpdate(Heap const *heap, MemAddr start, MemSize length, MemValue value);
+
+/* Returns the offsets within a block of the map, every map entry stands for 2^granularityShift use bytes.
+ * The entry of a block holds the value of its first byte. All other bytes of the block continue
+ * its chunk (0xF) if the block is allocated and are free (0x0) otherwise.
+ */
+static MemAddr granuleMask(Heap const *heap){
+	return ((MemAddr)1 << heap->granularityShift) - 1;
+}
+
+// Reads the map entry with the given index.
+static MemValue getEntry(Heap const *heap, MemAddr index){
+	if (index % 2 == 0)
+	{
+		return getHighNibble(heap, (heap->mapStart + index / 2));
+	}
+	return getLowNibble(heap, (heap->mapStart + index / 2));
+}
+
+// Rounds a size up to whole blocks of the map, sizes beyond the use area are left as they are.
+static MemSize roundToGranule(Heap const *heap, MemSize size){
+	if (size > heap->useSize)
+	{
+		return size;
+	}
+	return (size + granuleMask(heap)) & ~(MemSize)granuleMask(heap);
+}
+
+/* This function is used to set a heap map entry on a specific heap.
+ * Addresses within a block follow from the entry of the block, so setting them has no effect.
+ */
+void setMapEntry (Heap const *heap, MemAddr addr, MemValue value){
+	MemAddr temp = addr - (heap->useStart);
+	if (temp & granuleMask(heap))
+	{
+		return;
+	}
+	temp >>= heap->granularityShift;
+	if (temp % 2 == 0)
+	{
+		setHighNibble(heap, (heap->mapStart + temp / 2), value);
+	}else{
+		setLowNibble(heap, (heap->mapStart + temp / 2), value);
+	}
+	summaryUpdate(heap, addr, 1, value);
+}
+
+/* Sets the map entries of the use addresses in [start, start + length) to the given value.
+ * Only the entries of the blocks that start within the range are written.
+ * Only the two edge nibbles need a read-modify-write, all map bytes in between are written as a whole.
+ */
+void setMapRange (Heap const *heap, MemAddr start, MemSize length, MemValue value){
+	MemAddr offset = (start - heap->useStart + granuleMask(heap)) >> heap->granularityShift;
+	MemAddr const end = (start - heap->useStart + length + granuleMask(heap)) >> heap->granularityShift;
+	if (offset >= end)
+	{
+		return;
+	}
+	if (offset % 2 == 1)
+	{
+		setLowNibble(heap, (heap->mapStart + offset / 2), value);
+		offset++;
+	}
+	MemSize const wholeBytes = (end - offset) / 2;
+	if (wholeBytes > 0)
+	{
+		heap->mapDriver->fill(heap->mapStart + offset / 2, value | (value << 4), wholeBytes);
+		offset += 2 * wholeBytes;
+	}
+	if (offset < end)
+	{
+		setHighNibble(heap, (heap->mapStart + offset / 2), value);
+	}
+	summaryUpdate(heap, start, length, value);
+}
+
+// Function used to get the value of a single map entry, this is made public so the allocation strategies can use it.
+MemValue os_getMapEntry (Heap const *heap, MemAddr addr){
+	MemAddr temp = addr - (heap->useStart);
+	MemValue value = getEntry(heap, temp >> heap->granularityShift);
+	if ((temp & granuleMask(heap)) && value != 0)
+	{
+		return 0b00001111;
+	}
+	return value;
+}
+
+/* Like scanMapBytes, for heaps whose map entries stand for more than one byte.
+ * Every entry is read once and decides about the first byte of its block and about the rest of it.
+ */
+static MemAddr scanMapBlocks(Heap const *heap, MemAddr from, MemAddr to, MemValue value, bool equal){
+	MemAddr offset = from - heap->useStart;
+	MemAddr const endOffset = to - heap->useStart;
+	while (offset < endOffset)
+	{
+		MemValue const entry = getEntry(heap, offset >> heap->granularityShift);
+		if ((offset & granuleMask(heap)) == 0)
+		{
+			if ((entry == value) == equal)
+			{
+				return heap->useStart + offset;
+			}
+			offset++;
+		}
+		if (offset < endOffset && (((entry != 0 ? 0b00001111 : 0) == value) == equal))
+		{
+			return heap->useStart + offset;
+		}
+		offset = (offset | granuleMask(heap)) + 1;
+	}
+	return to;
+}
+
+/* Scans the map entries of the use addresses in [from, to) and returns the first address whose entry
+ * equals the given value (equal = true) or differs from it (equal = false), or to if there is none.
+ * Every map byte is read only once and bytes whose entries both equal the value are skipped as a whole.
+ */
+static MemAddr scanMapBytes(Heap const *heap, MemAddr from, MemAddr to, MemValue value, bool equal){
+	if (heap->granularityShift > 0)
+	{
+		return scanMapBlocks(heap, from, to, value, equal);
+	}
+	MemValue const uniform = value | (value << 4);
+	MemAddr offset = from - heap->useStart;
+	MemAddr const endOffset = to - heap->useStart;
+	while (offset < endOffset)
+	{
+		MemValue byte = heap->mapDriver->read(heap->mapStart + offset / 2);
+		if (offset % 2 == 0)
+		{
+			if (!equal && byte == uniform)
+			{
+				offset += 2;
+				continue;
+			}
+			if (((byte >> 4) == value) == equal)
+			{
+				return heap->useStart + offset;
+			}
+			offset++;
+		}
+		if (offset < endOffset && ((byte & 0b00001111) == value) == equal)
+		{
+			return heap->useStart + offset;
+		}
+		offset++;
+	}
+	return to;
+}
+
+// Returns bit b of the given summary bitmap.
+static bool summaryBit(uint8_t const *bits, uint16_t block){
+	return bits[block / 8] & (1 << (block % 8));
+}
+
+// Sets bit b of the given summary bitmap to the given value.
+static void summarySetBit(uint8_t *bits, uint16_t block, bool set){
+	if (set)
+	{
+		bits[block / 8] |= 1 << (block % 8);
+	}else{
+		bits[block / 8] &= ~(1 << (block % 8));
+	}
+}
+
+// Returns the use address behind the given block of the map summary.
+static MemAddr summaryBlockEnd(Heap const *heap, uint16_t block){
+	uint32_t const end = (uint32_t)(block + 1) << heap->summary.shift;
+	return (end < heap->useSize) ? heap->useStart + end : heap->useStart + heap->useSize;
+}
+
+/* Brings the summary bits of the blocks touched by [start, start + length) up to date after their map entries were set to the value.
+ * A block that is covered completely takes the state of the value. Only a partly covered block that already
+ * held both free and allocated bytes has to be scanned to find out whether it is uniform now.
+ */
+static void summaryUpdate(Heap const *heap, MemAddr start, MemSize length, MemValue value){
+	MapSummary const *summary = &heap->summary;
+	if (summary->shift == 0 || length == 0)
+	{
+		return;
+	}
+	uint16_t const first = (start - heap->useStart) >> summary->shift;
+	uint16_t const last = (start + length - 1 - heap->useStart) >> summary->shift;
+	for (uint16_t block = first; block <= last; block++)
+	{
+		MemAddr const blockStart = heap->useStart + ((MemAddr)block << summary->shift);
+		MemAddr const blockEnd = summaryBlockEnd(heap, block);
+		bool empty;
+		bool full;
+		if (start <= blockStart && start + length >= blockEnd)
+		{
+			empty = (value == 0);
+			full = (value != 0);
+		}else if (value == 0)
+		{
+			full = false;
+			empty = summaryBit(summary->emptyBits, block)
+				|| (!summaryBit(summary->fullBits, block) && scanMapBytes(heap, blockStart, blockEnd, 0, false) == blockEnd);
+		}else{
+			empty = false;
+			full = summaryBit(summary->fullBits, block)
+				|| (!summaryBit(summary->emptyBits, block) && scanMapBytes(heap, blockStart, blockEnd, 0, true) == blockEnd);
+		}
+		summarySetBit(summary->emptyBits, block, empty);
+		summarySetBit(summary->fullBits, block, full);
+	}
+}
+
+// Marks every block of the map summary as free, the map has to be cleared as well.
+void os_resetMapSummary(Heap *heap){
+	if (heap->summary.shift == 0)
+	{
+		return;
+	}
+	uint16_t const blocks = ((uint32_t)heap->useSize + (1ul << heap->summary.shift) - 1) >> heap->summary.shift;
+	for (uint16_t block = 0; block < blocks; block++)
+	{
+		summarySetBit(heap->summary.emptyBits, block, true);
+		summarySetBit(heap->summary.fullBits, block, false);
+	}
+}
+
+// Rebuilds the map summary of a heap by scanning its map once.
+static void rebuildMapSummary(Heap *heap){
+	if (heap->summary.shift == 0)
+	{
+		return;
+	}
+	uint16_t const blocks = ((uint32_t)heap->useSize + (1ul << heap->summary.shift) - 1) >> heap->summary.shift;
+	for (uint16_t block = 0; block < blocks; block++)
+	{
+		MemAddr const blockStart = heap->useStart + ((MemAddr)block << heap->summary.shift);
+		MemAddr const blockEnd = summaryBlockEnd(heap, block);
+		summarySetBit(heap->summary.emptyBits, block, scanMapBytes(heap, blockStart, blockEnd, 0, false) == blockEnd);
+		summarySetBit(heap->summary.fullBits, block, scanMapBytes(heap, blockStart, blockEnd, 0, true) == blockEnd);
+	}
+}
+
+/* Like scanMapBytes, but blocks of the map summary whose entries are all free or all allocated
+ * are decided as a whole, so only blocks holding both free and allocated bytes are read.
+ */
+MemAddr os_scanMap(Heap const *heap, MemAddr from, MemAddr to, MemValue value, bool equal){
+	MapSummary const *summary = &heap->summary;
+	if (summary->shift == 0)
+	{
+		return scanMapBytes(heap, from, to, value, equal);
+	}
+	while (from < to)
+	{
+		uint16_t const block = (from - heap->useStart) >> summary->shift;
+		MemAddr blockEnd = summaryBlockEnd(heap, block);
+		if (blockEnd > to)
+		{
+			blockEnd = to;
+		}
+		if (summaryBit(summary->emptyBits, block))
+		{
+			if ((value == 0) == equal)
+			{
+				return from;
+			}
+		}else if (value == 0 && summaryBit(summary->fullBits, block))
+		{
+			if (!equal)
+			{
+				return from;
+			}
+		}else{
+			MemAddr const found = scanMapBytes(heap, from, blockEnd, value, equal);
+			if (found < blockEnd)
+			{
+				return found;
+			}
+		}
+		from = blockEnd;
+	}
+	return to;
+}
+
+/* Like os_scanMap, but scans backwards from the given address down to the given limit, which is the start of the use area
+ * or the start of a block of at least two map entries. Returns the address in front of the limit if there is no matching entry.
+ */
+static MemAddr scanMapBackward(Heap const *heap, MemAddr from, MemAddr limit, MemValue value, bool equal){
+	MemValue const uniform = value | (value << 4);
+	if (from < limit)
+	{
+		return from;
+	}
+	MemAddr offset = from - heap->useStart;
+	MemAddr const limitOffset = limit - heap->useStart;
+	if (heap->granularityShift > 0)
+	{
+		while (true)
+		{
+			MemValue const entry = getEntry(heap, offset >> heap->granularityShift);
+			if ((offset & granuleMask(heap)) && (((entry != 0 ? 0b00001111 : 0) == value) == equal))
+			{
+				return heap->useStart + offset;
+			}
+			offset &= ~granuleMask(heap);
+			if ((entry == value) == equal)
+			{
+				return heap->useStart + offset;
+			}
+			if (offset == limitOffset)
+			{
+				return limit - 1;
+			}
+			offset--;
+		}
+	}
+	while (true)
+	{
+		MemValue byte = heap->mapDriver->read(heap->mapStart + offset / 2);
+		if (offset % 2 == 1)
+		{
+			if (!equal && byte == uniform)
+			{
+				if (offset == limitOffset + 1)
+				{
+					return limit - 1;
+				}
+				offset -= 2;
+				continue;
+			}
+			if (((byte & 0b00001111) == value) == equal)
+			{
+				return heap->useStart + offset;
+			}
+			offset--;
+		}
+		if (((byte >> 4) == value) == equal)
+		{
+			return heap->useStart + offset;
+		}
+		if (offset == limitOffset)
+		{
+			return limit - 1;
+		}
+		offset--;
+	}
+}
+
+// Decodes a field of HEAP_FIELD_SIZE bytes stored little-endian.
+static MemSize fieldDecode(MemValue const *bytes){
+	MemSize value = 0;
+	for (uint8_t i = HEAP_FIELD_SIZE; i > 0; i--)
+	{
+		value = (value << 8) | bytes[i - 1];
+	}
+	return value;
+}
+
+// Encodes a field of HEAP_FIELD_SIZE bytes little-endian.
+static void fieldEncode(MemValue *bytes, MemSize value){
+	for (uint8_t i = 0; i < HEAP_FIELD_SIZE; i++)
+	{
+		bytes[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+// Reads a field of HEAP_FIELD_SIZE bytes that the heap keeps in its own use area.
+MemSize os_readHeapField(Heap const *heap, MemAddr addr){
+	MemValue bytes[HEAP_FIELD_SIZE];
+	heap->driver->readBlock(addr, bytes, HEAP_FIELD_SIZE);
+	return fieldDecode(bytes);
+}
+
+// Writes a field of HEAP_FIELD_SIZE bytes to the use area of the heap.
+void os_writeHeapField(Heap const *heap, MemAddr addr, MemSize value){
+	MemValue bytes[HEAP_FIELD_SIZE];
+	fieldEncode(bytes, value);
+	heap->driver->writeBlock(addr, bytes, HEAP_FIELD_SIZE);
+}
+
+/* The free extents of a heap are kept in a list sorted by their start address. Its nodes are stored in the
+ * free memory itself, so the list holds every free extent however fragmented the heap is. The node of an
+ * extent lies at its start and consists of two fields of HEAP_FIELD_SIZE bytes:
+ *
+ *   start + 0: next listed extent (0 at the end), start + F: length of the extent
+ *
+ * Free ranges shorter than HEAP_EXTENT_NODE cannot hold a node and are not listed. Such a fragment always
+ * lies between two chunks and is merged as soon as one of them is freed, so every maximal free range of the
+ * map is either exactly one listed extent or a fragment. Every free byte between two listed extents thus
+ * belongs to a fragment and is found by scanning the map up to the next listed extent, which the map summary
+ * confines to the blocks holding free bytes. Requests that no fragment can hold skip that scan.
+ * The TLSF strategy keeps its free lists in the same memory, so the list is suspended while it is in use.
+ */
+
+// Returns the next listed extent behind the given one.
+static MemAddr extents_next(Heap const *heap, MemAddr node){
+	return os_readHeapField(heap, node);
+}
+
+// Returns the length of the given listed extent.
+static MemSize extents_length(Heap const *heap, MemAddr node){
+	return os_readHeapField(heap, node + HEAP_FIELD_SIZE);
+}
+
+// Writes the node of a listed extent.
+static void extents_writeNode(Heap const *heap, MemAddr node, MemAddr next, MemSize length){
+	MemValue bytes[HEAP_EXTENT_NODE];
+	fieldEncode(bytes, next);
+	fieldEncode(bytes + HEAP_FIELD_SIZE, length);
+	heap->driver->writeBlock(node, bytes, HEAP_EXTENT_NODE);
+}
+
+// Makes the given listed extent, or the head of the list if it is 0, point to the given node.
+static void extents_link(Heap *heap, MemAddr before, MemAddr node){
+	if (before == 0)
+	{
+		heap->freeHead = node;
+	}else{
+		os_writeHeapField(heap, before, node);
+	}
+}
+
+/* Returns the last listed extent that starts at or before the given address or 0 if there is none.
+ * The extent in front of it and the one behind it are stored in before and after, 0 if there is none.
+ * The walk continues at the extent the last walk stopped at if that one lies in front of the address,
+ * so a search through the heap in ascending order visits every listed extent only once.
+ */
+static MemAddr extents_seek(Heap *heap, MemAddr addr, MemAddr *before, MemAddr *after){
+	MemAddr prev = 0;
+	MemAddr node = 0;
+	MemAddr next = heap->freeHead;
+	if (heap->freeCursor != 0 && heap->freeCursor <= addr)
+	{
+		prev = heap->freeCursorBefore;
+		node = heap->freeCursor;
+		next = extents_next(heap, node);
+	}
+	while (next != 0 && next <= addr)
+	{
+		prev = node;
+		node = next;
+		next = extents_next(heap, node);
+	}
+	heap->freeCursorBefore = prev;
+	heap->freeCursor = node;
+	*before = prev;
+	*after = next;
+	return node;
+}
+
+/* Removes a range that has just been allocated from the free-extent list.
+ * Returns the length of the free extent the range was cut from, an upper bound for a fragment and 0 if it is not known.
+ */
+static MemSize extents_reserve(Heap *heap, MemAddr start, MemSize length){
+	if (heap->freeIndexState != HEAP_INDEX_VALID)
+	{
+		return 0;
+	}
+	MemAddr before;
+	MemAddr after;
+	MemAddr const node = extents_seek(heap, start, &before, &after);
+	heap->freeCursor = 0;
+	MemAddr const nodeEnd = (node != 0) ? node + extents_length(heap, node) : 0;
+	if (nodeEnd <= start)
+	{
+		// the range lies within a fragment, whatever remains of it is a fragment as well
+		return HEAP_EXTENT_NODE - 1;
+	}
+	MemAddr const end = start + length;
+	if (nodeEnd < end)
+	{
+		// the list does not match the map anymore
+		heap->freeIndexState = HEAP_INDEX_STALE;
+		return 0;
+	}
+	// a remainder that is too short for a node becomes a fragment
+	MemAddr next = after;
+	if (nodeEnd - end >= HEAP_EXTENT_NODE)
+	{
+		extents_writeNode(heap, end, after, nodeEnd - end);
+		next = end;
+	}
+	if (start - node >= HEAP_EXTENT_NODE)
+	{
+		extents_writeNode(heap, node, next, start - node);
+	}else{
+		extents_link(heap, before, next);
+	}
+	return nodeEnd - node;
+}
+
+/* Adds a range that has just been freed to the free-extent list and merges it with the free ranges around it.
+ * Returns the length of the free extent it is part of now, 0 if it is not known.
+ */
+static MemSize extents_release(Heap *heap, MemAddr start, MemSize length){
+	if (heap->freeIndexState != HEAP_INDEX_VALID || length == 0)
+	{
+		return 0;
+	}
+	MemAddr const useEnd = heap->useStart + heap->useSize;
+	MemAddr before;
+	MemAddr next;
+	MemAddr const node = extents_seek(heap, start - 1, &before, &next);
+	heap->freeCursor = 0;
+	MemAddr first = start;
+	MemAddr end = start + length;
+	bool const mergePrev = (node != 0) && (node + extents_length(heap, node) == start);
+	if (!mergePrev)
+	{
+		// free bytes in front belong to a fragment
+		while (start - first < HEAP_EXTENT_NODE && first > heap->useStart && os_getMapEntry(heap, first - 1) == 0)
+		{
+			first--;
+		}
+	}
+	if (next == end)
+	{
+		end += extents_length(heap, next);
+		next = extents_next(heap, next);
+	}else{
+		// so do free bytes behind
+		end = os_scanMap(heap, end, (useEnd - end > HEAP_EXTENT_NODE) ? end + HEAP_EXTENT_NODE : useEnd, 0, false);
+	}
+	if (mergePrev)
+	{
+		extents_writeNode(heap, node, next, end - node);
+		return end - node;
+	}
+	if (end - first >= HEAP_EXTENT_NODE)
+	{
+		extents_writeNode(heap, first, next, end - first);
+		extents_link(heap, node, first);
+	}
+	return end - first;
+}
+
+/* Rebuilds the free-extent list of a heap by scanning its map once.
+ * While the TLSF strategy is in use, the list is suspended instead.
+ */
+void os_rebuildFreeExtents(Heap *heap){
+	os_enterCriticalSection();
+	heap->freeHead = 0;
+	heap->freeCursor = 0;
+	if (heap->strategy == OS_MEM_TLSF)
+	{
+		heap->freeIndexState = HEAP_INDEX_SUSPENDED;
+		os_leaveCriticalSection();
+		return;
+	}
+	heap->freeIndexState = HEAP_INDEX_VALID;
+	MemAddr const end = heap->useStart + heap->useSize;
+	MemAddr addr = heap->useStart;
+	MemAddr last = 0;
+	while (addr < end)
+	{
+		MemAddr start = os_scanMap(heap, addr, end, 0, true);
+		if (start == end)
+		{
+			break;
+		}
+		addr = os_scanMap(heap, start, end, 0, false);
+		if (addr - start >= HEAP_EXTENT_NODE)
+		{
+			extents_writeNode(heap, start, 0, addr - start);
+			extents_link(heap, last, start);
+			last = start;
+		}
+	}
+	os_leaveCriticalSection();
+}
+
+// Finds the first free range of the map that starts in [from, to) and clips it to start at from.
+static bool scanFreeExtent(Heap const *heap, MemAddr from, MemAddr to, FreeExtent *extent){
+	extent->start = os_scanMap(heap, from, to, 0, true);
+	if (extent->start >= to)
+	{
+		return false;
+	}
+	extent->length = os_scanMap(heap, extent->start, heap->useStart + heap->useSize, 0, false) - extent->start;
+	return true;
+}
+
+/* Finds the first free extent that ends after the given address and clips it to start at that address.
+ * Free extents shorter than the given size may be left out. The free-extent list is used whenever it is valid,
+ * so the map is only scanned for fragments that can hold the size and while the list is suspended.
+ * Returns false if there is no such extent.
+ */
+bool os_nextFreeExtent(Heap *heap, MemAddr from, MemSize size, FreeExtent *extent){
+	MemAddr const end = heap->useStart + heap->useSize;
+	if (from < heap->useStart)
+	{
+		from = heap->useStart;
+	}
+	if (heap->freeIndexState == HEAP_INDEX_STALE)
+	{
+		os_rebuildFreeExtents(heap);
+	}
+	if (heap->freeIndexState != HEAP_INDEX_VALID)
+	{
+		return scanFreeExtent(heap, from, end, extent);
+	}
+	MemAddr before;
+	MemAddr next;
+	MemAddr const node = extents_seek(heap, from, &before, &next);
+	if (node != 0)
+	{
+		MemAddr const nodeEnd = node + extents_length(heap, node);
+		if (nodeEnd > from)
+		{
+			extent->start = from;
+			extent->length = nodeEnd - from;
+			return true;
+		}
+	}
+	if (size < HEAP_EXTENT_NODE && scanFreeExtent(heap, from, (next != 0) ? next : end, extent))
+	{
+		return true;
+	}
+	if (next == 0)
+	{
+		return false;
+	}
+	extent->start = next;
+	extent->length = extents_length(heap, next);
+	return true;
+}
+
+// Returns the first address of the block of the chunk table that holds the given address.
+static MemAddr tags_blockStart(Heap const *heap, MemAddr addr){
+	return heap->useStart + (((addr - heap->useStart) >> heap->tags.shift) << heap->tags.shift);
+}
+
+// Writes the start and the length of a chunk into the chunk table entries of all blocks whose first byte it covers.
+static void tags_set(Heap const *heap, MemAddr start, MemSize length){
+	if (heap->layout != OS_LAYOUT_TAGGED || length == 0)
+	{
+		return;
+	}
+	MemValue entry[CHUNK_TABLE_ENTRY];
+	fieldEncode(entry, start);
+	fieldEncode(entry + HEAP_FIELD_SIZE, length);
+	MemSize const blockSize = (MemSize)1 << heap->tags.shift;
+	MemSize const end = start - heap->useStart + length;
+	for (MemSize offset = (start - heap->useStart + blockSize - 1) & ~(blockSize - 1); offset < end; offset += blockSize)
+	{
+		heap->driver->writeBlock(heap->tags.start + (offset >> heap->tags.shift) * CHUNK_TABLE_ENTRY, entry, CHUNK_TABLE_ENTRY);
+	}
+}
+
+// Reads the chunk that covers the first byte of the block holding the given address from the chunk table.
+static void tags_read(Heap const *heap, MemAddr addr, MemRange *tag){
+	MemValue entry[CHUNK_TABLE_ENTRY];
+	heap->driver->readBlock(heap->tags.start + ((addr - heap->useStart) >> heap->tags.shift) * CHUNK_TABLE_ENTRY, entry, CHUNK_TABLE_ENTRY);
+	tag->start = fieldDecode(entry);
+	tag->length = fieldDecode(entry + HEAP_FIELD_SIZE);
+}
+
+// Rebuilds the chunk table of a heap by scanning its map once.
+static void rebuildChunkTags(Heap *heap){
+	MemAddr const end = heap->useStart + heap->useSize;
+	MemAddr addr = heap->useStart;
+	while (addr < end)
+	{
+		MemAddr start = os_scanMap(heap, addr, end, 0, false);
+		if (start == end)
+		{
+			break;
+		}
+		addr = os_scanMap(heap, start + 1, end, 0b00001111, false);
+		if (os_getMapEntry(heap, start) != 0b00001111)
+		{
+			// a chunk tail without an owner entry can only be left behind by erasing the map
+			tags_set(heap, start, addr - start);
+		}
+	}
+}
+
+// Returns the row of the owner blocks of a process, NULL if the heap keeps none or the owner is not a process.
+static uint8_t* owners_row(Heap *heap, MemValue owner){
+	if (heap->owners.shift == 0 || owner == 0 || owner >= MAX_NUMBER_OF_PROCESSES)
+	{
+		return NULL;
+	}
+	return heap->owners.bits + (owner - 1) * SUMMARY_BYTES(heap->useSize, heap->owners.shift);
+}
+
+// Notes that a chunk of the given owner starts at the given address.
+static void owners_mark(Heap *heap, MemAddr start, MemValue owner){
+	uint8_t *row = owners_row(heap, owner);
+	if (row != NULL)
+	{
+		summarySetBit(row, (start - heap->useStart) >> heap->owners.shift, true);
+	}
+}
+
+// Forgets the blocks of every process.
+void os_resetOwnerBlocks(Heap *heap){
+	if (heap->owners.shift == 0)
+	{
+		return;
+	}
+	uint16_t const bytes = (MAX_NUMBER_OF_PROCESSES - 1) * SUMMARY_BYTES(heap->useSize, heap->owners.shift);
+	for (uint16_t i = 0; i < bytes; i++)
+	{
+		heap->owners.bits[i] = 0;
+	}
+}
+
+// Rebuilds the owner blocks of every process by scanning the map once.
+static void rebuildOwnerBlocks(Heap *heap){
+	os_resetOwnerBlocks(heap);
+	MemAddr const end = heap->useStart + heap->useSize;
+	MemAddr addr = heap->useStart;
+	while (addr < end)
+	{
+		MemAddr start = os_scanMap(heap, addr, end, 0, false);
+		if (start == end)
+		{
+			break;
+		}
+		addr = os_scanMap(heap, start + 1, end, 0b00001111, false);
+		owners_mark(heap, start, os_getMapEntry(heap, start));
+	}
+}
+
+// Returns whether the given address lies within the use area and is free.
+static bool isFreeByte(Heap const *heap, MemAddr addr){
+	return addr >= heap->useStart && addr < heap->useStart + heap->useSize && os_getMapEntry(heap, addr) == 0;
+}
+
+// Returns the entry of ownerBytes that counts the chunks of the given owner.
+static uint8_t stats_slot(MemValue owner){
+	return (owner < MAX_NUMBER_OF_PROCESSES) ? owner : 0;
+}
+
+// Returns the number of used bytes of a heap and raises its high-water mark if necessary.
+static MemSize stats_used(Heap *heap){
+	MemSize used = 0;
+	for (uint8_t i = 0; i < MAX_NUMBER_OF_PROCESSES; i++)
+	{
+		used += heap->ownerBytes[i];
+	}
+	if (used > heap->highWater)
+	{
+		heap->highWater = used;
+	}
+	return used;
+}
+
+// Counts a range that is about to be allocated, only its neighbours are looked at so that the map may already be changed.
+static void stats_reserve(Heap *heap, MemAddr start, MemSize length, MemValue owner){
+	bool freeBefore = isFreeByte(heap, start - 1);
+	bool freeAfter = isFreeByte(heap, start + length);
+	if (freeBefore && freeAfter)
+	{
+		heap->freeExtentTotal++;
+	}else if (!freeBefore && !freeAfter)
+	{
+		heap->freeExtentTotal--;
+	}
+	heap->ownerBytes[stats_slot(owner)] += length;
+	stats_used(heap);
+}
+
+// Counts a range that is about to be freed, the counterpart of stats_reserve.
+static void stats_release(Heap *heap, MemAddr start, MemSize length, MemValue owner){
+	bool freeBefore = isFreeByte(heap, start - 1);
+	bool freeAfter = isFreeByte(heap, start + length);
+	if (freeBefore && freeAfter)
+	{
+		heap->freeExtentTotal--;
+	}else if (!freeBefore && !freeAfter)
+	{
+		heap->freeExtentTotal++;
+	}
+	heap->ownerBytes[stats_slot(owner)] -= length;
+}
+
+// Notes that an allocation was cut from a free extent of the given length, 0 if it is not known, which may have been the largest one.
+static void stats_cut(Heap *heap, MemSize length){
+	if (length == 0 || length >= heap->largestFree)
+	{
+		heap->largestFreeStale = true;
+	}
+}
+
+// Notes that a released range is part of a free extent of the given length now, 0 if it is not known.
+static void stats_merge(Heap *heap, MemSize length){
+	if (length == 0)
+	{
+		heap->largestFreeStale = true;
+	}else if (length > heap->largestFree)
+	{
+		heap->largestFree = length;
+	}
+}
+
+// Recounts the statistics of a heap by scanning its map once.
+static void rebuildHeapStats(Heap *heap){
+	for (uint8_t i = 0; i < MAX_NUMBER_OF_PROCESSES; i++)
+	{
+		heap->ownerBytes[i] = 0;
+	}
+	heap->freeExtentTotal = 0;
+	MemAddr const end = heap->useStart + heap->useSize;
+	MemAddr addr = heap->useStart;
+	while (addr < end)
+	{
+		MemAddr start = os_scanMap(heap, addr, end, 0, false);
+		if (start > addr)
+		{
+			heap->freeExtentTotal++;
+		}
+		if (start == end)
+		{
+			break;
+		}
+		addr = os_scanMap(heap, start + 1, end, 0b00001111, false);
+		heap->ownerBytes[stats_slot(os_getMapEntry(heap, start))] += addr - start;
+	}
+	stats_used(heap);
+	heap->largestFreeStale = true;
+}
+
+// Rebuilds all bookkeeping of a heap that is kept in RAM from its map, e.g. after the map was changed directly.
+void os_resyncHeap(Heap *heap){
+	os_enterCriticalSection();
+	os_rebuildFreeExtents(heap);
+	if (heap->layout == OS_LAYOUT_TAGGED)
+	{
+		rebuildChunkTags(heap);
+	}
+	rebuildMapSummary(heap);
+	rebuildOwnerBlocks(heap);
+	rebuildHeapStats(heap);
+	os_Memory_ResetStrategy(heap);
+	// the handles cannot be trusted anymore if the map was changed behind their back
+	for (uint8_t i = 0; i < HEAP_HANDLES; i++)
+	{
+		heap->handles[i].addr = 0;
+	}
+	heap->compaction.handle = 0;
+	os_leaveCriticalSection();
 }
 
-// Reads the value of the lower nibble of the given address.
-MemValue getLowNibble (Heap const *heap, MemAddr addr){
-	return (heap->driver->read(addr) & 0b00001111);
+// Returns whether the strategy of the heap decides about the placement of every chunk itself.
+static bool placesChunksItself(Heap const *heap){
+	return heap->strategy == OS_MEM_SLAB || heap->strategy == OS_MEM_BUDDY || heap->strategy == OS_MEM_TLSF;
 }
 
-// Reads the value of the higher nibble of the given address.
-MemValue getHighNibble (Heap const *heap, MemAddr addr){
-	return (heap->driver->read(addr) >> 4);
+// Writes a new chunk of the given owner to the map and removes it from the free-extent index.
+static void claimChunk(Heap *heap, MemAddr start, MemSize size, MemValue owner){
+	stats_reserve(heap, start, size, owner);
+	setMapEntry(heap, start, owner);
+	setMapRange(heap, start + 1, size - 1, 0b00001111);
+	MemSize cut = extents_reserve(heap, start, size);
+	tags_set(heap, start, size);
+	owners_mark(heap, start, owner);
+	switch (heap->strategy)
+	{
+		case OS_MEM_SLAB:
+			os_Memory_SlabClaim(heap, start);
+			break;
+		case OS_MEM_BUDDY:
+			os_Memory_BuddyClaim(heap, start, size);
+			break;
+		case OS_MEM_TLSF:
+			cut = os_Memory_TlsfClaim(heap, start, size);
+			break;
+		default:
+			break;
+	}
+	stats_cut(heap, cut);
 }
 
-// This function is used to set a heap map entry on a specific heap.
-void setMapEntry (Heap const *heap, MemAddr addr, MemValue value){
-	MemAddr temp = addr - (heap->useStart);
-	if (temp % 2 == 0)
+// Marks a range of the given owner as free in the map and adds it to the free-extent index.
+static void releaseRange(Heap *heap, MemAddr start, MemSize size, MemValue owner){
+	if (size == 0)
 	{
-		setHighNibble(heap, (heap->mapStart + temp / 2), value);
-	}else{
-		setLowNibble(heap, (heap->mapStart + temp / 2), value);
+		return;
+	}
+	stats_release(heap, start, size, owner);
+	setMapRange(heap, start, size, 0);
+	MemSize merged = extents_release(heap, start, size);
+	switch (heap->strategy)
+	{
+		case OS_MEM_SLAB:
+			os_Memory_SlabRelease(heap, start);
+			break;
+		case OS_MEM_BUDDY:
+			os_Memory_BuddyRelease(heap, start, size);
+			break;
+		case OS_MEM_TLSF:
+			merged = os_Memory_TlsfRelease(heap, start, size);
+			break;
+		default:
+			break;
 	}
+	stats_merge(heap, merged);
 }
 
-// Function used to get the value of a single map entry, this is made public so the allocation strategies can use it.
-MemValue os_getMapEntry (Heap const *heap, MemAddr addr){
-	MemAddr temp = addr - (heap->useStart);
-	if (temp % 2 == 0)
+// Adds a free range to the chunk of the given owner in front of or behind it, the strategy of the heap must not place chunks itself.
+static void growChunk(Heap *heap, MemAddr start, MemSize length, MemValue owner){
+	stats_reserve(heap, start, length, owner);
+	setMapRange(heap, start, length, 0b00001111);
+	stats_cut(heap, extents_reserve(heap, start, length));
+}
+
+// Asks the allocation strategy of the heap for a free chunk of the given size.
+static MemAddr findFreeChunk(Heap *heap, MemSize size){
+	switch (heap->strategy)
 	{
-		return getHighNibble(heap, (heap->mapStart + temp / 2));
-	}
-	else{
-		return getLowNibble(heap, (heap->mapStart + temp / 2));
+		case OS_MEM_FIRST:
+			return os_Memory_FirstFit(heap, size);
+		case OS_MEM_NEXT:
+			return os_Memory_NextFit(heap, size);
+		case OS_MEM_WORST:
+			return os_Memory_WorstFit(heap, size);
+		case OS_MEM_BEST:
+			return os_Memory_BestFit(heap, size);
+		case OS_MEM_SLAB:
+			return os_Memory_Slab(heap, size);
+		case OS_MEM_BUDDY:
+			return os_Memory_Buddy(heap, size);
+		case OS_MEM_TLSF:
+			return os_Memory_Tlsf(heap, size);
 	}
+	return 0;
 }
 
 // Function used to allocate private memory.
-MemAddr os_malloc(Heap* heap, size_t size){
+MemAddr os_malloc(Heap* heap, MemSize size){
 	os_enterCriticalSection();
 	MemAddr allocStart = 0;
 	ProcessID current = os_getCurrentProc();
@@ -68,37 +975,11 @@ MemAddr os_malloc(Heap* heap, size_t size){
 		os_leaveCriticalSection();
 		return 0;
 	}
-	switch (heap->strategy)
-	{
-		case OS_MEM_FIRST:
-			allocStart = os_Memory_FirstFit(heap, size);
-			break;
-		case OS_MEM_NEXT:
-			allocStart = os_Memory_NextFit(heap, size);
-			break;
-		case OS_MEM_WORST:
-			allocStart = os_Memory_WorstFit(heap, size);
-			break;
-		case OS_MEM_BEST:
-			allocStart = os_Memory_BestFit(heap, size);
-			break;
-	}
+	size = roundToGranule(heap, size);
+	allocStart = findFreeChunk(heap, size);
 	if (allocStart != 0)
 	{
-		setMapEntry(heap, allocStart, current);
-		for (MemAddr i = allocStart + 1; i < allocStart + size; i++)
-		{
-			setMapEntry(heap, i, 0b00001111);
-		}
-		// Optimierung: renew the starting/ending frame of the process
-		if ((heap->allocFrameStart[current] == 0) || ( heap->allocFrameStart[current] > allocStart))
-		{
-			heap->allocFrameStart[current] = allocStart;
-		}
-		if ((heap->allocFrameEnd[current] == 0) || ( heap->allocFrameEnd[current] < allocStart + size -1))
-		{
-			heap->allocFrameEnd[current] = allocStart + size -1;
-		}
+		claimChunk(heap, allocStart, size, current);
 		os_leaveCriticalSection();
 		return allocStart;
 	}
@@ -108,7 +989,7 @@ MemAddr os_malloc(Heap* heap, size_t size){
 }
 
 // Function used to allocate shared memory.
-MemAddr os_sh_malloc(Heap *heap, size_t size){
+MemAddr os_sh_malloc(Heap *heap, MemSize size){
 	os_enterCriticalSection();
 	MemAddr allocStart = 0;
 	ProcessID current = os_getCurrentProc();
@@ -123,28 +1004,11 @@ MemAddr os_sh_malloc(Heap *heap, size_t size){
 		os_leaveCriticalSection();
 		return 0;
 	}
-	switch (heap->strategy)
-	{
-		case OS_MEM_FIRST:
-			allocStart = os_Memory_FirstFit(heap, size);
-			break;
-		case OS_MEM_NEXT:
-			allocStart = os_Memory_NextFit(heap, size);
-			break;
-		case OS_MEM_WORST:
-			allocStart = os_Memory_WorstFit(heap, size);
-			break;
-		case OS_MEM_BEST:
-			allocStart = os_Memory_BestFit(heap, size);
-			break;
-	}
+	size = roundToGranule(heap, size);
+	allocStart = findFreeChunk(heap, size);
 	if (allocStart != 0)
 	{
-		setMapEntry(heap, allocStart, SHARED_MEMORY);
-		for (MemAddr i = allocStart + 1; i < allocStart + size; i++)
-		{
-			setMapEntry(heap, i, 0b00001111);
-		}
+		claimChunk(heap, allocStart, size, SHARED_MEMORY);
 		os_leaveCriticalSection();
 		return allocStart;
 	}
@@ -154,12 +1018,20 @@ MemAddr os_sh_malloc(Heap *heap, size_t size){
 
 // Get the address of the first byte of chunk.
 MemAddr os_getFirstByteOfChunk (Heap const *heap, MemAddr addr){
-	MemAddr firstByte = addr;
-	while (os_getMapEntry(heap, firstByte) == 0b00001111)
+	if (heap->layout == OS_LAYOUT_TAGGED && addr >= heap->useStart && addr < heap->useStart + heap->useSize)
 	{
-		firstByte--;
+		// a chunk that does not start within the block of the address covers the first byte of that block
+		MemAddr const blockStart = tags_blockStart(heap, addr);
+		MemAddr const start = scanMapBackward(heap, addr, blockStart, 0b00001111, false);
+		if (start >= blockStart)
+		{
+			return start;
+		}
+		MemRange tag;
+		tags_read(heap, blockStart, &tag);
+		return tag.start;
 	}
-	return firstByte;
+	return scanMapBackward(heap, addr, heap->useStart, 0b00001111, false);
 }
 
 // This function determines the value of the first nibble of a chunk.
@@ -168,24 +1040,33 @@ ProcessID getOwnerOfChunk (Heap const *heap, MemAddr addr){
 }
 
 // Get the size of a chunk on a given address.
-uint16_t os_getChunkSize (Heap const *heap, MemAddr addr){
+MemSize os_getChunkSize (Heap const *heap, MemAddr addr){
 	MemAddr firstByte = os_getFirstByteOfChunk(heap, addr);
-	while (((os_getMapEntry(heap, addr) == 0b00001111) || (addr == firstByte)) && (addr < heap->useStart+heap->useSize))
+	MemAddr const end = heap->useStart + heap->useSize;
+	if (heap->layout == OS_LAYOUT_TAGGED && os_getMapEntry(heap, firstByte) != 0)
 	{
-		addr++;
+		// a chunk that does not end within its block covers the first byte of the next one
+		MemAddr const nextBlock = tags_blockStart(heap, firstByte) + ((MemAddr)1 << heap->tags.shift);
+		if (nextBlock < end)
+		{
+			MemAddr const chunkEnd = os_scanMap(heap, firstByte + 1, nextBlock + 1, 0b00001111, false);
+			if (chunkEnd <= nextBlock)
+			{
+				return chunkEnd - firstByte;
+			}
+			MemRange tag;
+			tags_read(heap, nextBlock, &tag);
+			return tag.length;
+		}
 	}
-	addr--;
-	return (addr - firstByte + 1);
+	return os_scanMap(heap, firstByte + 1, end, 0b00001111, false) - firstByte;
 }
 
 // Frees the chunk iff it is owned by the given owner.
 void os_freeOwnerRestricted (Heap *heap, MemAddr addr, ProcessID owner) {
 	MemAddr firstByte = os_getFirstByteOfChunk(heap, addr);
 	if (owner == os_getMapEntry(heap, firstByte) ) {
-		MemAddr lastByte = os_getFirstByteOfChunk(heap, addr) + os_getChunkSize(heap, addr);
-		for( ; firstByte < lastByte; firstByte++) {
-			setMapEntry(heap, firstByte, 0);
-		}
+		releaseRange(heap, firstByte, os_getChunkSize(heap, addr), owner);
 	}
 }
 
@@ -204,39 +1085,8 @@ void os_free (Heap *heap, MemAddr addr){
 		os_leaveCriticalSection();
 		return;
 	}
-	MemAddr lastByte = os_getFirstByteOfChunk(heap, addr) + os_getChunkSize(heap, addr);
+	// the block of the chunk stays noted for the owner until os_freeProcessMemory clears it
 	os_freeOwnerRestricted(heap, addr, owner);
-	// renew the starting/ending frame of the process
-	// find the new start frame of the process
-	if (heap->allocFrameStart[owner] == firstByte)
-	{
-		heap->allocFrameStart[owner] = 0;
-		MemAddr x = firstByte + 1;
-		while (x < heap->useStart + heap->useSize)
-		{
-			if (os_getMapEntry(heap, x) == owner)
-			{
-				heap->allocFrameStart[owner] = x;
-				break;
-			}
-			x++;
-		}
-	}
-	// find the new end frame of the process
-	if (heap->allocFrameEnd[owner] == lastByte - 1)
-	{
-		heap->allocFrameEnd[owner] = 0;
-		MemAddr y = firstByte - 1;
-		while (y >= heap->useStart)
-		{
-			if (getOwnerOfChunk(heap, y) == owner)
-			{
-				heap->allocFrameEnd[owner] = y;
-				break;
-			}
-			y--;
-		}
-	}
 	os_leaveCriticalSection();
 }
 
@@ -255,30 +1105,75 @@ void os_sh_free(Heap *heap, MemAddr *addr){
 		return;
 	}
 	while(value != SHARED_MEMORY) {
-		os_yield();
+		os_waitIn(&sharedWaiters);
 		value = os_getMapEntry(heap, os_getFirstByteOfChunk(heap, *addr));
 	}
 	os_freeOwnerRestricted(heap, *addr, SHARED_MEMORY);
 	os_leaveCriticalSection();
 }
 
+// Frees every chunk of the given process that starts within the given range, only the first byte of a chunk holds the owner in the map.
+static void freeOwnerRange(Heap *heap, ProcessID pid, MemAddr from, MemAddr to){
+	while ((from = os_scanMap(heap, from, to, pid, true)) < to)
+	{
+		MemSize size = os_getChunkSize(heap, from);
+		os_freeOwnerRestricted(heap, from, pid);
+		from += size;
+	}
+}
+
 // Function that realises the garbage collection.
 void os_freeProcessMemory(Heap *heap, ProcessID pid){
 	os_enterCriticalSection();
-	for (MemAddr i = heap->allocFrameStart[pid]; i <= heap->allocFrameEnd[pid]; i++)
+	for (uint8_t i = 0; i < HEAP_HANDLES; i++)
+	{
+		if (heap->handles[i].addr != 0 && getOwnerOfChunk(heap, heap->handles[i].addr) == pid)
+		{
+			heap->handles[i].addr = 0;
+			if (heap->compaction.handle == i + 1)
+			{
+				heap->compaction.handle = 0;
+			}
+		}
+	}
+	uint8_t *row = owners_row(heap, pid);
+	if (row == NULL)
+	{
+		freeOwnerRange(heap, pid, heap->useStart, heap->useStart + heap->useSize);
+		os_leaveCriticalSection();
+		return;
+	}
+	// only the blocks a chunk of the process was placed in since its last cleanup are scanned
+	uint16_t const blocks = ((uint32_t)heap->useSize + (1ul << heap->owners.shift) - 1) >> heap->owners.shift;
+	for (uint16_t block = 0; block < blocks; block++)
 	{
-		os_freeOwnerRestricted(heap, i, pid);
+		if (row[block / 8] == 0)
+		{
+			block |= 7;
+			continue;
+		}
+		if (summaryBit(row, block))
+		{
+			summarySetBit(row, block, false);
+			MemAddr const blockStart = heap->useStart + ((MemAddr)block << heap->owners.shift);
+			MemAddr blockEnd = blockStart + ((MemAddr)1 << heap->owners.shift);
+			if (blockEnd > heap->useStart + heap->useSize || blockEnd < blockStart)
+			{
+				blockEnd = heap->useStart + heap->useSize;
+			}
+			freeOwnerRange(heap, pid, blockStart, blockEnd);
+		}
 	}
 	os_leaveCriticalSection();
 }
 
 // Get the size of the heap-map.
-size_t 	os_getMapSize (Heap const *heap) {
+MemSize 	os_getMapSize (Heap const *heap) {
 	return heap->mapSize;
 }
 
 // Get the size of the usable heap.
-size_t 	os_getUseSize (Heap const *heap) {
+MemSize 	os_getUseSize (Heap const *heap) {
 	return heap->useSize;
 }
 
@@ -292,15 +1187,172 @@ MemAddr os_getUseStart (Heap const *heap) {
 	return heap->useStart;
 }
 
+/* Returns the length of the largest free extent of a heap. It is kept up to date by every release
+ * and only searched for again after an allocation cut the largest one known.
+ */
+static MemSize largestFreeExtent(Heap *heap){
+	if (!heap->largestFreeStale)
+	{
+		return heap->largestFree;
+	}
+	if (heap->freeIndexState == HEAP_INDEX_STALE)
+	{
+		os_rebuildFreeExtents(heap);
+	}
+	MemSize largest = 0;
+	if (heap->freeIndexState == HEAP_INDEX_VALID)
+	{
+		for (MemAddr node = heap->freeHead; node != 0; node = extents_next(heap, node))
+		{
+			MemSize const length = extents_length(heap, node);
+			if (length > largest)
+			{
+				largest = length;
+			}
+		}
+	}else{
+		largest = os_Memory_TlsfLargest(heap);
+	}
+	if (largest == 0)
+	{
+		// without a listed extent or block, the free bytes are spread over fragments
+		MemAddr const end = heap->useStart + heap->useSize;
+		FreeExtent extent = { .start = heap->useStart, .length = 0 };
+		while (scanFreeExtent(heap, extent.start + extent.length, end, &extent))
+		{
+			if (extent.length > largest)
+			{
+				largest = extent.length;
+			}
+		}
+	}
+	heap->largestFree = largest;
+	heap->largestFreeStale = false;
+	return largest;
+}
+
+// Reports the usage of a heap from the statistics kept up to date by every allocation and release.
+void os_getHeapStats(Heap *heap, HeapStats *stats){
+	os_enterCriticalSection();
+	MemSize used = 0;
+	for (uint8_t i = 0; i < MAX_NUMBER_OF_PROCESSES; i++)
+	{
+		stats->ownerBytes[i] = heap->ownerBytes[i];
+		used += heap->ownerBytes[i];
+	}
+	stats->freeBytes = heap->useSize - used;
+	stats->highWater = heap->highWater;
+	stats->freeExtentCount = heap->freeExtentTotal;
+	stats->largestFreeExtent = largestFreeExtent(heap);
+	stats->fragmentation = (stats->freeBytes == 0) ? 0 : 100 - (uint8_t)((100ul * stats->largestFreeExtent) / stats->freeBytes);
+	os_leaveCriticalSection();
+}
+
 // Returns the current memory management strategy.
 AllocStrategy os_getAllocationStrategy(Heap const* heap){
 	return heap->strategy;
 }
 
+/* Copies the given number of bytes within the use area of a heap through a buffer on the stack.
+ * The bytes are copied upwards, so the destination must not start within the source.
+ */
+static void copyRange(Heap const *heap, MemAddr from, MemAddr to, MemSize length){
+	MemValue buffer[HEAP_COPY_BUFFER];
+	if (from == to)
+	{
+		return;
+	}
+	while (length > 0)
+	{
+		uint16_t part = (length < HEAP_COPY_BUFFER) ? length : HEAP_COPY_BUFFER;
+		heap->driver->readBlock(from, buffer, part);
+		heap->driver->writeBlock(to, buffer, part);
+		from += part;
+		to += part;
+		length -= part;
+	}
+}
+
+/* Starts to slide the relocatable chunk at the given address down to the start of the free memory in front of it.
+ * Until the move is finished, the chunk reaches from its new start up to its old end in the map,
+ * so neither the old nor the new location can be allocated in between.
+ */
+static void startMove(Heap *heap, MemHandle handle, MemAddr from){
+	Compaction *move = &heap->compaction;
+	MemAddr to = scanMapBackward(heap, from - 1, heap->useStart, 0, false) + 1;
+	ProcessID owner = getOwnerOfChunk(heap, from);
+	stats_reserve(heap, to, from - to, owner);
+	move->handle = handle;
+	move->to = to;
+	move->size = os_getChunkSize(heap, from);
+	move->done = 0;
+	setMapEntry(heap, to, owner);
+	setMapRange(heap, to + 1, from - to, 0b00001111);
+	stats_cut(heap, extents_reserve(heap, to, from - to));
+	tags_set(heap, to, from - to + move->size);
+	owners_mark(heap, to, owner);
+}
+
+// Copies at most the given number of bytes of the chunk that is being moved and finishes the move once everything was copied.
+static void stepMove(Heap *heap, MemSize budget){
+	Compaction *move = &heap->compaction;
+	HandleEntry *entry = &heap->handles[move->handle - 1];
+	MemAddr from = entry->addr;
+	// the chunk only moves down, so copying upwards never overwrites bytes that still have to be copied
+	MemSize part = move->size - move->done;
+	if (part > budget)
+	{
+		part = budget;
+	}
+	copyRange(heap, from + move->done, move->to + move->done, part);
+	move->done += part;
+	if (move->done < move->size)
+	{
+		return;
+	}
+	ProcessID owner = getOwnerOfChunk(heap, move->to);
+	releaseRange(heap, move->to + move->size, from - move->to, owner);
+	tags_set(heap, move->to, move->size);
+	entry->addr = move->to;
+	move->handle = 0;
+}
+
+// Finishes the move of a relocatable chunk if there is one in progress.
+static void finishMove(Heap *heap){
+	if (heap->compaction.handle != 0)
+	{
+		stepMove(heap, heap->compaction.size);
+	}
+}
+
 // Changes the memory management strategy.
 void os_setAllocationStrategy(Heap *heap, AllocStrategy allocStrat){
 	os_enterCriticalSection();
-	heap->strategy = allocStrat;
+	if (allocStrat == OS_MEM_BUDDY && heap->buddy.blockShift == 0)
+	{
+		os_error("no buddy tree on heap");
+		os_leaveCriticalSection();
+		return;
+	}
+	if (allocStrat == OS_MEM_TLSF && heap->tlsf.classCount == 0)
+	{
+		os_error("no TLSF index on heap");
+		os_leaveCriticalSection();
+		return;
+	}
+	if (heap->strategy != allocStrat)
+	{
+		finishMove(heap);
+		// the bookkeeping of the old strategy does not match the chunks the new one is going to place
+		bool const tlsfChanged = (heap->strategy == OS_MEM_TLSF) != (allocStrat == OS_MEM_TLSF);
+		heap->strategy = allocStrat;
+		// the TLSF strategy takes the free memory over from the free-extent list and gives it back
+		if (tlsfChanged)
+		{
+			os_rebuildFreeExtents(heap);
+		}
+		os_Memory_ResetStrategy(heap);
+	}
 	os_leaveCriticalSection();
 }
 
@@ -309,29 +1361,41 @@ void os_setAllocationStrategy(Heap *heap, AllocStrategy allocStrat){
  * as well as all Map Entries are set properly since this is a helper function for reallocation,
  * it only works if the new Chunk is bigger than the old one.
  */
-void moveChunk(Heap *heap, MemAddr oldChunk, size_t oldSize, MemAddr newChunk, size_t newSize){
+void moveChunk(Heap *heap, MemAddr oldChunk, MemSize oldSize, MemAddr newChunk, MemSize newSize){
 	if (newSize > oldSize)
 	{
 		ProcessID pid = getOwnerOfChunk(heap, oldChunk);
-		os_free(heap, oldChunk);
-		// copy the values stored in the old chunk
-		for(MemAddr i = oldChunk; i < oldChunk + oldSize; ++i) {
-			heap->driver->write(newChunk + (i - oldChunk), heap->driver->read(i));
+		if ((newChunk >= oldChunk + oldSize) || (newChunk + newSize <= oldChunk))
+		{
+			// A strategy may store its bookkeeping in free memory, so the new chunk is claimed
+			// before anything is copied into it and the old one is freed only after it was copied.
+			claimChunk(heap, newChunk, newSize, pid);
+			// copy the values stored in the old chunk, the new chunk never starts within the old one
+			copyRange(heap, oldChunk, newChunk, oldSize);
+			os_free(heap, oldChunk);
+			return;
 		}
-		// renew the map entries
-		setMapEntry(heap, newChunk, pid);
-		for(MemAddr i = newChunk + 1; i < newChunk + newSize; ++i) {
-			setMapEntry(heap, i, 15);
+		// The chunk grows into the free memory around it. That memory may hold nodes of the free-extent list,
+		// so it is claimed before the chunk is copied and the part of the old chunk it leaves behind is freed afterwards.
+		MemAddr const oldEnd = oldChunk + oldSize;
+		MemAddr const newEnd = newChunk + newSize;
+		if (newChunk < oldChunk)
+		{
+			growChunk(heap, newChunk, oldChunk - newChunk, pid);
+			setMapEntry(heap, newChunk, pid);
+			setMapEntry(heap, oldChunk, 0b00001111);
 		}
-		// Optimierung: renew the starting/ending frame of the process
-		if ((heap->allocFrameStart[pid] == 0) || ( heap->allocFrameStart[pid] > newChunk))
+		if (newEnd > oldEnd)
 		{
-			heap->allocFrameStart[pid] = newChunk;
+			growChunk(heap, oldEnd, newEnd - oldEnd, pid);
 		}
-		if ((heap->allocFrameEnd[pid] == 0) || ( heap->allocFrameEnd[pid] < newChunk + newSize -1))
+		copyRange(heap, oldChunk, newChunk, oldSize);
+		if (newEnd < oldEnd)
 		{
-			heap->allocFrameEnd[pid] = newChunk + newSize -1;
+			releaseRange(heap, newEnd, oldEnd - newEnd, pid);
 		}
+		tags_set(heap, newChunk, newSize);
+		owners_mark(heap, newChunk, pid);
 	}
 }
 
@@ -340,7 +1404,7 @@ void moveChunk(Heap *heap, MemAddr oldChunk, size_t oldSize, MemAddr newChunk, s
  * If possible, the position of the chunk remains the same.
  * It is only searched for a completely new chunk if everything else does not fit.
  */
-MemAddr os_realloc(Heap *heap, MemAddr addr, uint16_t size){
+MemAddr os_realloc(Heap *heap, MemAddr addr, MemSize size){
 	os_enterCriticalSection();
 	ProcessID pid = os_getCurrentProc();
 	if (pid == 0)
@@ -350,32 +1414,36 @@ MemAddr os_realloc(Heap *heap, MemAddr addr, uint16_t size){
 		return 0;
 	}
 	else{
+		size = roundToGranule(heap, size);
 		MemAddr firstByte = os_getFirstByteOfChunk(heap, addr);
 		// Ein Prozess darf ausschlielich von ihm selbst allozierten Speicher reallozieren.
 		if(os_getMapEntry(heap,firstByte) != pid) {
 			os_leaveCriticalSection();
 			return 0;
 		}
-		uint16_t oldSize = os_getChunkSize(heap, addr);
+		MemSize oldSize = os_getChunkSize(heap, addr);
 		// If the new size is smaller than the old size, the chunk does not need to move.
 		// We only need to free the redundant memory.
 		if (size <= oldSize) {
-			for(MemAddr i = firstByte + size; i < firstByte + oldSize; ++i) {
-				setMapEntry(heap ,i, 0); // free the redundant memory by setting the corresponding map nibble
-			}
+			releaseRange(heap, firstByte + size, oldSize - size, pid); // free the redundant memory by setting the corresponding map nibbles
+			tags_set(heap, firstByte, size);
 			os_leaveCriticalSection();
 			return addr;
 		}
 		// If the new size is not smaller than the old size, we need to find a new chunk to reallocate.
-		// 1. We check if there is enough space directly after the original chunk.
-		MemAddr firstAfterOld = firstByte + oldSize;
-		// find out the first occupied byte after the old chunk and so the free space after the old chunk.
-		for(; firstAfterOld < heap->useStart+heap->useSize; ++firstAfterOld) {
-			if(os_getMapEntry(heap,firstAfterOld) != 0) {
-				break;
+		// The slab, buddy and TLSF strategies decide about the placement of every chunk themselves, so it always gets a new chunk.
+		if (placesChunksItself(heap)) {
+			MemAddr realloc = findFreeChunk(heap, size);
+			if (realloc != 0) {
+				moveChunk(heap, firstByte, oldSize, realloc, size);
 			}
+			os_leaveCriticalSection();
+			return realloc;
 		}
-		uint16_t spaceAfterOld = firstAfterOld - (firstByte + oldSize);
+		// 1. We check if there is enough space directly after the original chunk.
+		// find out the first occupied byte after the old chunk and so the free space after the old chunk.
+		MemAddr firstAfterOld = os_scanMap(heap, firstByte + oldSize, heap->useStart + heap->useSize, 0, false);
+		MemSize spaceAfterOld = firstAfterOld - (firstByte + oldSize);
 		if(size - oldSize <= spaceAfterOld) {
 			moveChunk(heap, firstByte, oldSize, firstByte, size);
 			// no need to free anything
@@ -384,21 +1452,16 @@ MemAddr os_realloc(Heap *heap, MemAddr addr, uint16_t size){
 		}
 		// 2. If there is no enough space after the old chunk,
 		// We continue to check the space right before the chunk to see if the space after and the space before together is enough?
-		MemAddr firstBeforeOld = firstByte - 1;
 		// find out the first occupied byte before the old chunk and so the free space before the old chunk.
-		for(; firstBeforeOld >= heap->useStart; firstBeforeOld--) {
-			if(os_getMapEntry(heap,firstBeforeOld) != 0) {
-				break;
-			}
-		}
-		uint16_t spaceBeforeOld = firstByte - firstBeforeOld - 1;
+		MemAddr firstBeforeOld = scanMapBackward(heap, firstByte - 1, heap->useStart, 0, false);
+		MemSize spaceBeforeOld = firstByte - firstBeforeOld - 1;
 		if (size - oldSize <= spaceAfterOld + spaceBeforeOld){
 			moveChunk(heap, firstByte, oldSize, firstBeforeOld + 1, size);
 			os_leaveCriticalSection();
 			return firstBeforeOld + 1;
 		}
 		// 3. If the space before and after together is still not enough, we use malloc to allocate a new chunk and release the old chunk.
-		MemAddr realloc = os_malloc(heap, size);
+		MemAddr realloc = findFreeChunk(heap, size);
 		// nicht gengend Speicher zur Verfgung steht
 		if (realloc == 0) {
 			os_leaveCriticalSection();
@@ -422,7 +1485,7 @@ MemAddr os_sh_readOpen(Heap const *heap, MemAddr const *ptr){
 	} 
 	else {
 		while (value == SHARED_MEMORY_WRITING || value == SHARED_MEMORY_READING5){
-			os_yield();
+			os_waitIn(&sharedWaiters);
 			value = os_getMapEntry(heap, os_getFirstByteOfChunk(heap, *ptr));
 		}
 		switch (value){
@@ -453,7 +1516,7 @@ MemAddr os_sh_writeOpen(Heap const *heap, MemAddr const *ptr){
 		return 0;
 	} else {
 		while(value != SHARED_MEMORY){
-			os_yield();		
+			os_waitIn(&sharedWaiters);
 			value = os_getMapEntry(heap, os_getFirstByteOfChunk(heap, *ptr));
 		}
 		setMapEntry(heap, os_getFirstByteOfChunk(heap, *ptr), SHARED_MEMORY_WRITING);
@@ -483,82 +1546,175 @@ void os_sh_close(Heap const *heap, MemAddr addr){
 			os_error("os_sh_close default error");
 			break;
 	}
+	os_wakeAll(&sharedWaiters);
 	os_leaveCriticalSection();
 }
 
 // Function used to write to shared memory. 
-void os_sh_write(Heap const *heap, MemAddr const *ptr, uint16_t offset, MemValue const *dataSrc, uint16_t length){
+void os_sh_write(Heap const *heap, MemAddr const *ptr, MemSize offset, MemValue const *dataSrc, uint16_t length){
 	if(*ptr < heap->useStart || *ptr >= heap->useStart+heap->useSize) {
 		os_error("os_sh_write outbounded");
 		return;
 	}
 	MemAddr gate = os_sh_writeOpen (heap, ptr);
-	MemAddr index = gate;
-	if (offset == 0)
-	{
-		heap->driver->write(index, *dataSrc);
-		++dataSrc;
-		++index;
-		--length;
-	}
-	while(offset > 0) {
-		++index;
-		--offset;
-		if(os_getMapEntry(heap, index) != 15 ) {
-			os_error("os_sh_write_offset_error");
-			os_sh_close(heap, gate);
-			return;
-		}
+	if (gate == 0)
+	{
+		return;
 	}
-	while (length > 0) {
-		if(os_getMapEntry(heap, index)!= 15) {
-			os_error("os_sh_write_length_error");
-			os_sh_close(heap, gate);
-			return;
-		}
-		heap->driver->write(index, *dataSrc);
-		++dataSrc;
-		++index;
-		--length;
+	// the accessed bytes have to lie within the chunk, which is checked once instead of per byte
+	MemSize chunkSize = os_getChunkSize(heap, gate);
+	if (offset >= chunkSize) {
+		os_error("os_sh_write_offset_error");
+		os_sh_close(heap, gate);
+		return;
+	}
+	if (length > chunkSize - offset) {
+		os_error("os_sh_write_length_error");
+		os_sh_close(heap, gate);
+		return;
 	}
+	heap->driver->writeBlock(gate + offset, dataSrc, length);
 	os_sh_close(heap, gate);
 }
 
 // Function used to read from shared memory.
-void os_sh_read(Heap const *heap, MemAddr const *ptr, uint16_t offset, MemValue *dataDest, uint16_t length){
+void os_sh_read(Heap const *heap, MemAddr const *ptr, MemSize offset, MemValue *dataDest, uint16_t length){
 	if(*ptr < heap->useStart || *ptr >= heap->useStart+heap->useSize) {
 		os_error("os_sh_read outbounded");
 		return;
 	}
 	MemAddr gate = os_sh_readOpen (heap, ptr);
-	MemAddr index = gate;
-	if (offset == 0)
-	{
-		*dataDest = heap->driver->read(index);
-		++dataDest;
-		++index;
-		--length;
-	}
-	while(offset > 0) {
-		++index;
-		--offset;
-		if(os_getMapEntry(heap, index) != 15 ) {
-			os_error("os_sh_read_offset_error");
-			os_sh_close(heap, gate);
-			return;
+	if (gate == 0)
+	{
+		return;
+	}
+	// the accessed bytes have to lie within the chunk, which is checked once instead of per byte
+	MemSize chunkSize = os_getChunkSize(heap, gate);
+	if (offset >= chunkSize) {
+		os_error("os_sh_read_offset_error");
+		os_sh_close(heap, gate);
+		return;
+	}
+	if (length > chunkSize - offset) {
+		os_error("os_sh_read_length_error");
+		os_sh_close(heap, gate);
+		return;
+	}
+	heap->driver->readBlock(gate + offset, dataDest, length);
+	os_sh_close(heap, gate);
+}
+
+// Returns the entry of a handle if the handle is in use and belongs to the current process, raises an error otherwise.
+static HandleEntry* lookupHandle(Heap *heap, MemHandle handle){
+	if (handle == 0 || handle > HEAP_HANDLES || heap->handles[handle - 1].addr == 0
+	|| getOwnerOfChunk(heap, heap->handles[handle - 1].addr) != os_getCurrentProc())
+	{
+		os_error("invalid handle");
+		return NULL;
+	}
+	return &heap->handles[handle - 1];
+}
+
+/* Allocates private memory that os_compactHeap may move while it is not opened.
+ * Returns 0 if there is no free handle or not enough memory.
+ */
+MemHandle os_h_malloc(Heap *heap, MemSize size){
+	os_enterCriticalSection();
+	MemHandle handle = 0;
+	for (uint8_t i = 0; i < HEAP_HANDLES; i++)
+	{
+		if (heap->handles[i].addr == 0)
+		{
+			MemAddr addr = os_malloc(heap, size);
+			if (addr != 0)
+			{
+				heap->handles[i].addr = addr;
+				heap->handles[i].openCount = 0;
+				handle = i + 1;
+			}
+			break;
 		}
 	}
-	while (length > 0) {
-		if(os_getMapEntry(heap, index)!= 15) {
-			os_error("os_sh_read_length_error");
-			os_sh_close(heap, gate);
-			return;
+	os_leaveCriticalSection();
+	return handle;
+}
+
+// Frees the memory of a handle and the handle itself.
+void os_h_free(Heap *heap, MemHandle handle){
+	os_enterCriticalSection();
+	HandleEntry *entry = lookupHandle(heap, handle);
+	if (entry != NULL)
+	{
+		// a chunk that is being moved still reaches from its new start up to its old end, os_free releases all of it
+		os_free(heap, entry->addr);
+		if (heap->compaction.handle == handle)
+		{
+			heap->compaction.handle = 0;
 		}
-		*dataDest = heap->driver->read(index);
-		++dataDest;
-		++index;
-		--length;
+		entry->addr = 0;
 	}
-	os_sh_close(heap, gate);
+	os_leaveCriticalSection();
+}
+
+/* Opens the access window of a handle and returns the current address of its memory.
+ * The address stays valid until the matching os_h_close, the chunk may move afterwards.
+ */
+MemAddr os_h_open(Heap *heap, MemHandle handle){
+	os_enterCriticalSection();
+	HandleEntry *entry = lookupHandle(heap, handle);
+	MemAddr addr = 0;
+	if (entry != NULL)
+	{
+		if (heap->compaction.handle == handle)
+		{
+			finishMove(heap);
+		}
+		entry->openCount++;
+		addr = entry->addr;
+	}
+	os_leaveCriticalSection();
+	return addr;
+}
+
+// Closes an access window opened by os_h_open.
+void os_h_close(Heap *heap, MemHandle handle){
+	os_enterCriticalSection();
+	HandleEntry *entry = lookupHandle(heap, handle);
+	if (entry != NULL && entry->openCount > 0)
+	{
+		entry->openCount--;
+	}
+	os_leaveCriticalSection();
 }
 
+/* Moves the relocatable chunks of a heap that are not opened towards the start of its use area.
+ * At most HEAP_COMPACT_STEP bytes are copied per call, so that the idle process can call it repeatedly.
+ * Heaps with a strategy that places every chunk itself are not compacted.
+ */
+void os_compactHeap(Heap *heap){
+	os_enterCriticalSection();
+	if (heap->compaction.handle == 0 && !placesChunksItself(heap))
+	{
+		// move the lowest chunk that has free memory in front of it first
+		MemHandle handle = 0;
+		for (uint8_t i = 0; i < HEAP_HANDLES; i++)
+		{
+			MemAddr addr = heap->handles[i].addr;
+			if (addr > heap->useStart && heap->handles[i].openCount == 0
+			&& (handle == 0 || addr < heap->handles[handle - 1].addr)
+			&& os_getMapEntry(heap, addr - 1) == 0)
+			{
+				handle = i + 1;
+			}
+		}
+		if (handle != 0)
+		{
+			startMove(heap, handle, heap->handles[handle - 1].addr);
+		}
+	}
+	if (heap->compaction.handle != 0)
+	{
+		stepMove(heap, HEAP_COMPACT_STEP);
+	}
+	os_leaveCriticalSection();
+}
@@ -5,19 +5,19 @@
 #include "os_memheap_drivers.h"
 #include "os_scheduler.h"
 
-MemAddr os_malloc(Heap* heap, size_t size);
+MemAddr os_malloc(Heap* heap, MemSize size);
 
 void os_free(Heap *heap, MemAddr addr);
 
-size_t os_getMapSize(Heap const* heap);
+MemSize os_getMapSize(Heap const* heap);
 
-size_t os_getUseSize(Heap const* heap);
+MemSize os_getUseSize(Heap const* heap);
 
 MemAddr os_getMapStart(Heap const* heap);
 
 MemAddr os_getUseStart(Heap const* heap);
 
-uint16_t os_getChunkSize(Heap const* heap, MemAddr addr);
+MemSize os_getChunkSize(Heap const* heap, MemAddr addr);
 
 AllocStrategy os_getAllocationStrategy(Heap const* heap);
 
@@ -25,11 +25,29 @@ void os_setAllocationStrategy(Heap *heap, AllocStrategy allocStrat);
 
 MemValue os_getMapEntry (Heap const *heap, MemAddr addr);
 
+MemSize os_readHeapField(Heap const *heap, MemAddr addr);
+
+void os_writeHeapField(Heap const *heap, MemAddr addr, MemSize value);
+
+MemAddr os_scanMap(Heap const *heap, MemAddr from, MemAddr to, MemValue value, bool equal);
+
+bool os_nextFreeExtent(Heap *heap, MemAddr from, MemSize size, FreeExtent *extent);
+
+void os_rebuildFreeExtents(Heap *heap);
+
+void os_resyncHeap(Heap *heap);
+
+void os_resetOwnerBlocks(Heap *heap);
+
+void os_resetMapSummary(Heap *heap);
+
+void os_getHeapStats(Heap *heap, HeapStats *stats);
+
 void os_freeProcessMemory(Heap *heap, ProcessID pid);
 
-MemAddr os_realloc(Heap *heap, MemAddr addr, uint16_t size);
+MemAddr os_realloc(Heap *heap, MemAddr addr, MemSize size);
 
-MemAddr os_sh_malloc(Heap *heap, size_t size);
+MemAddr os_sh_malloc(Heap *heap, MemSize size);
 
 void os_sh_free(Heap *heap, MemAddr *addr);
 
@@ -39,8 +57,18 @@ MemAddr os_sh_writeOpen(Heap const *heap, MemAddr const *ptr);
 
 void os_sh_close(Heap const *heap, MemAddr addr);
 
-void os_sh_write(Heap const *heap, MemAddr const *ptr, uint16_t offset, MemValue const *dataSrc, uint16_t length);
+void os_sh_write(Heap const *heap, MemAddr const *ptr, MemSize offset, MemValue const *dataSrc, uint16_t length);
+
+void os_sh_read(Heap const *heap, MemAddr const *ptr, MemSize offset, MemValue *dataDest, uint16_t length);
+
+MemHandle os_h_malloc(Heap *heap, MemSize size);
+
+void os_h_free(Heap *heap, MemHandle handle);
+
+MemAddr os_h_open(Heap *heap, MemHandle handle);
+
+void os_h_close(Heap *heap, MemHandle handle);
 
-void os_sh_read(Heap const *heap, MemAddr const *ptr, uint16_t offset, MemValue *dataDest, uint16_t length);
+void os_compactHeap(Heap *heap);
 
 #endif
@@ -1,151 +1,818 @@
 #include "os_memory_strategies.h"
 #include "os_memory.h"
 
+/* All strategies walk the free extents of the heap via os_nextFreeExtent.
+ * It follows the free-extent list of the heap, which holds every free extent
+ * that is at least HEAP_EXTENT_NODE bytes long, so a search takes time
+ * proportional to the number of free extents instead of the heap size.
+ * Only requests shorter than that also look at the fragments between the
+ * listed extents, whose map scan skips the blocks that the map summary of the
+ * heap marks as entirely allocated.
+ */
 
+MemAddr os_Memory_FirstFit(Heap *heap, MemSize size){
+	FreeExtent extent;
+	MemAddr from = heap->useStart;
+	while (os_nextFreeExtent(heap, from, size, &extent))
+	{
+		if (extent.length >= size)
+		{
+			return extent.start;
+		}
+		from = extent.start + extent.length;
+	}
+	return 0;
+}
 
-MemAddr os_Memory_FirstFit(Heap *heap, size_t size){
-	size_t freeSize = 0;
-	for (MemAddr start = heap->useStart; start < heap->useStart + heap->useSize; start++){
-		if (os_getMapEntry(heap, start) == 0){
-			freeSize++;
-			if (freeSize == size)
+// Searches the free extents between the given addresses for the first one that fits.
+static MemAddr nextFitRange(Heap *heap, MemSize size, MemAddr from, MemAddr to){
+	FreeExtent extent;
+	while (from < to && os_nextFreeExtent(heap, from, size, &extent))
+	{
+		if (extent.length >= size)
+		{
+			if (extent.start + size != heap->useStart + heap->useSize)
 			{
-				return (start - size + 1);
+				heap->lastAddr = extent.start + size;
+			}else{
+				heap->lastAddr = heap->useStart;
 			}
+			return extent.start;
 		}
-		else
-		{
-			freeSize = 0;
-		}
+		from = extent.start + extent.length;
 	}
 	return 0;
 }
 
-MemAddr os_Memory_NextFit(Heap *heap, size_t size)
+MemAddr os_Memory_NextFit(Heap *heap, MemSize size)
 {
 	if (heap->lastAddr == 0)
 	{
 		heap->lastAddr = heap->useStart;
 	}
-	size_t freeSize = 0;
-	for (MemAddr start = heap->lastAddr; start < heap->useStart + heap->useSize; start++){
-		if (os_getMapEntry(heap, start) == 0){
-			freeSize++;
-			if (freeSize == size)
+	MemAddr found = nextFitRange(heap, size, heap->lastAddr, heap->useStart + heap->useSize);
+	if (found == 0)
+	{
+		found = nextFitRange(heap, size, heap->useStart, heap->useStart + heap->useSize);
+	}
+	if (found == 0)
+	{
+		heap->lastAddr = 0;
+	}
+	return found;
+}
+
+MemAddr os_Memory_BestFit(Heap *heap, MemSize size)
+{
+	FreeExtent extent;
+	MemAddr best = 0;
+	MemSize bestArea = 0;
+	MemAddr from = heap->useStart;
+	while (os_nextFreeExtent(heap, from, size, &extent))
+	{
+		if (extent.length == size)
+		{
+			return extent.start;
+		}
+		if (extent.length > size && (best == 0 || extent.length < bestArea))
+		{
+			best = extent.start;
+			bestArea = extent.length;
+		}
+		from = extent.start + extent.length;
+	}
+	return best;
+}
+
+MemAddr os_Memory_WorstFit(Heap *heap, MemSize size)
+{
+	FreeExtent extent;
+	MemAddr worst = 0;
+	MemSize worstArea = 0;
+	MemAddr from = heap->useStart;
+	while (os_nextFreeExtent(heap, from, size, &extent))
+	{
+		if (extent.length > size)
+		{
+			// no other free extent can be larger than one that holds half of the heap
+			if (extent.length >= heap->useSize / 2)
 			{
-				if (start != heap->useStart + heap->useSize - 1)
-				{
-					heap->lastAddr = start + 1;
-				}else{
-					heap->lastAddr = heap->useStart;
-				}
-					return (start - size + 1);				
+				return extent.start;
+			}
+			if (extent.length > worstArea)
+			{
+				worst = extent.start;
+				worstArea = extent.length;
 			}
 		}
-		else
+		from = extent.start + extent.length;
+	}
+	return worst;
+}
+
+/* The slab strategy serves requests of up to HEAP_SLAB_MAX_SIZE bytes from slabs, i.e. ranges of
+ * HEAP_SLAB_SLOTS slots of one power-of-two size class. Every object still is an ordinary chunk in the
+ * map, so owner tracking and os_freeProcessMemory are unaffected. Free slots are free in the map as well
+ * and the slab only keeps them from being handed out to any other request. Finding and freeing a slot
+ * only looks at the slabs of the heap, which takes constant time.
+ */
+
+// Returns the number of bytes covered by a slab.
+static MemSize slabSize(Slab const *slab){
+	return (MemSize)slab->slotSize * HEAP_SLAB_SLOTS;
+}
+
+// Returns the slab containing the given address or NULL if there is none.
+static Slab* slabLookup(Heap *heap, MemAddr addr){
+	for (uint8_t i = 0; i < HEAP_SLABS; i++)
+	{
+		Slab *slab = &heap->slabs[i];
+		if (slab->start != 0 && slab->start <= addr && addr - slab->start < slabSize(slab))
 		{
-			freeSize = 0;
+			return slab;
 		}
 	}
-	freeSize = 0;
-	for (MemAddr start = heap->useStart; start < heap->useStart + heap->useSize; start++){
-		if (os_getMapEntry(heap, start) == 0){
-			freeSize++;
-			if (freeSize == size)
+	return NULL;
+}
+
+// First fit over the free extents that leaves the ranges of all slabs untouched.
+static MemAddr slabFreeRange(Heap *heap, MemSize size){
+	FreeExtent extent;
+	MemAddr from = heap->useStart;
+	while (os_nextFreeExtent(heap, from, size, &extent))
+	{
+		MemAddr start = extent.start;
+		MemAddr const end = extent.start + extent.length;
+		bool moved = true;
+		while (moved && start < end && end - start >= size)
+		{
+			moved = false;
+			for (uint8_t i = 0; i < HEAP_SLABS; i++)
 			{
-				if (start != heap->useStart + heap->useSize - 1)
+				Slab const *slab = &heap->slabs[i];
+				if (slab->start != 0 && slab->start < start + size && start < slab->start + slabSize(slab))
 				{
-					heap->lastAddr = start + 1;
-				}else{
-					heap->lastAddr = heap->useStart;
+					start = slab->start + slabSize(slab);
+					moved = true;
+					if (start >= end)
+					{
+						break;
+					}
 				}
-				return (start - size + 1);
 			}
 		}
-		else
+		if (start < end && end - start >= size)
 		{
-			freeSize = 0;
+			return start;
 		}
+		from = end;
 	}
-	heap->lastAddr = 0;
 	return 0;
 }
 
-MemAddr os_Memory_BestFit(Heap *heap, size_t size)
-{
-	MemAddr bestInd = 0;
-	size_t bestArea = heap->useSize + 1;
-	
-	for (size_t i = 0; i < heap->useSize;) {
-		size_t currSize = 0;
-		for (size_t j = i; j < heap->useSize; j++)
-		{
-			MemValue val = os_getMapEntry(heap, heap->useStart + j);
-			if  (val != 0)
-			{
-				break;
-			}
-			currSize++;
+// Dissolves all slabs of the heap or only those without any allocated slot.
+void os_Memory_SlabDissolve(Heap *heap, bool emptyOnly){
+	for (uint8_t i = 0; i < HEAP_SLABS; i++)
+	{
+		if (!emptyOnly || heap->slabs[i].freeSlots == 0xFFFF)
+		{
+			heap->slabs[i].start = 0;
 		}
-		
-		if (currSize == size)
+	}
+}
+
+// Like slabFreeRange, but gives the memory of empty slabs back to the heap if nothing else fits.
+static MemAddr slabFreeRangeOrDissolve(Heap *heap, MemSize size){
+	MemAddr found = slabFreeRange(heap, size);
+	if (found == 0)
+	{
+		os_Memory_SlabDissolve(heap, true);
+		found = slabFreeRange(heap, size);
+	}
+	return found;
+}
+
+// Carves a new slab for the given size class, returns NULL if there is no slab or no memory left.
+static Slab* slabCarve(Heap *heap, uint8_t slotSize){
+	Slab *slab = NULL;
+	for (uint8_t i = 0; i < HEAP_SLABS && slab == NULL; i++)
+	{
+		if (heap->slabs[i].start == 0)
+		{
+			slab = &heap->slabs[i];
+		}
+	}
+	for (uint8_t i = 0; i < HEAP_SLABS && slab == NULL; i++)
+	{
+		if (heap->slabs[i].freeSlots == 0xFFFF)
+		{
+			slab = &heap->slabs[i];
+			slab->start = 0;
+		}
+	}
+	if (slab == NULL)
+	{
+		return NULL;
+	}
+	MemAddr start = slabFreeRangeOrDissolve(heap, (MemSize)slotSize * HEAP_SLAB_SLOTS);
+	if (start == 0)
+	{
+		return NULL;
+	}
+	slab->start = start;
+	slab->slotSize = slotSize;
+	slab->freeSlots = 0xFFFF;
+	return slab;
+}
+
+MemAddr os_Memory_Slab(Heap *heap, MemSize size){
+	if (size > HEAP_SLAB_MAX_SIZE)
+	{
+		return slabFreeRangeOrDissolve(heap, size);
+	}
+	uint8_t slotSize = 1;
+	while (slotSize < size)
+	{
+		slotSize <<= 1;
+	}
+	Slab *slab = NULL;
+	for (uint8_t i = 0; i < HEAP_SLABS && slab == NULL; i++)
+	{
+		if (heap->slabs[i].start != 0 && heap->slabs[i].slotSize == slotSize && heap->slabs[i].freeSlots != 0)
 		{
-			return heap->useStart + i;
+			slab = &heap->slabs[i];
 		}
-		
-		if (currSize > size && currSize < bestArea)
+	}
+	if (slab == NULL)
+	{
+		slab = slabCarve(heap, slotSize);
+	}
+	if (slab == NULL)
+	{
+		// no slab available, so the request is served like a large one
+		return slabFreeRangeOrDissolve(heap, size);
+	}
+	uint8_t slot = 0;
+	while (!(slab->freeSlots & (1u << slot)))
+	{
+		slot++;
+	}
+	return slab->start + (MemAddr)slot * slotSize;
+}
+
+// Marks the slot starting at the given address as allocated.
+void os_Memory_SlabClaim(Heap *heap, MemAddr addr){
+	Slab *slab = slabLookup(heap, addr);
+	if (slab != NULL)
+	{
+		slab->freeSlots &= ~(1u << ((addr - slab->start) / slab->slotSize));
+	}
+}
+
+// Marks the slot starting at the given address as free, addresses within a slot are ignored.
+void os_Memory_SlabRelease(Heap *heap, MemAddr addr){
+	Slab *slab = slabLookup(heap, addr);
+	if (slab != NULL && (addr - slab->start) % slab->slotSize == 0)
+	{
+		slab->freeSlots |= 1u << ((addr - slab->start) / slab->slotSize);
+	}
+}
+
+/* The buddy strategy splits the use area into blocks whose sizes are powers of two. A request gets the
+ * smallest free block it fits into, which is split in halves as often as possible first. A freed block
+ * is merged with its buddy, i.e. the other half of the block it was split from, as long as that is free.
+ * The whole tree is kept in internal SRAM, so neither decision needs to access the heap itself.
+ * Freeing walks one path of the tree. Allocating skips the levels without free blocks by their free counts
+ * and finds the first free block of a level through two summary levels above the free bits, which tell
+ * which bytes of the free bits are not 0. So it reads three bytes instead of the whole bitmap of the level.
+ * Smallest blocks that held chunks of another strategy when the tree was built are pinned and only
+ * become free once the map shows them as free.
+ */
+
+// Returns the bit of a buddy tree that belongs to block i on the given level.
+static uint16_t buddyBit(BuddyTree const *tree, uint8_t level, uint8_t i){
+	uint16_t bit = i;
+	for (uint8_t k = 0; k < level; k++)
+	{
+		bit += tree->leafCount >> k;
+	}
+	return bit;
+}
+
+static bool buddyTest(uint8_t const *bits, uint16_t bit){
+	return bits[bit / 8] & (1 << (bit % 8));
+}
+
+static void buddyAssign(uint8_t *bits, uint16_t bit, bool value){
+	if (value)
+	{
+		bits[bit / 8] |= 1 << (bit % 8);
+	}else{
+		bits[bit / 8] &= ~(1 << (bit % 8));
+	}
+}
+
+// Marks a block as free or not free and keeps the number of free blocks per level and the summary of the free bits.
+static void buddySetFree(BuddyTree *tree, uint8_t level, uint8_t i, bool free){
+	uint16_t bit = buddyBit(tree, level, i);
+	if (buddyTest(tree->freeBits, bit) != free)
+	{
+		buddyAssign(tree->freeBits, bit, free);
+		if (free)
 		{
-			bestInd = i;
-			bestArea = currSize;
+			tree->freeCount[level]++;
+		}else{
+			tree->freeCount[level]--;
 		}
-		
-		i += currSize + 1;
+		uint8_t const byte = bit / 8;
+		buddyAssign(tree->freeSummary, byte, tree->freeBits[byte] != 0);
+		buddyAssign(&tree->freeTop, byte / 8, tree->freeSummary[byte / 8] != 0);
 	}
-	
-	if (bestArea == heap->useSize + 1) {
+}
+
+// Returns the size of the blocks on the given level.
+static MemSize buddyBlockSize(BuddyTree const *tree, uint8_t level){
+	return (MemSize)1 << (level + tree->blockShift);
+}
+
+// Returns the highest level that has a block containing the given smallest block.
+static uint8_t buddyTopLevel(BuddyTree const *tree, uint8_t leaf){
+	uint8_t level = HEAP_BUDDY_LEVELS - 1;
+	while ((leaf >> level) >= (tree->leafCount >> level))
+	{
+		level--;
+	}
+	return level;
+}
+
+// Finds the block that contains the given smallest block, i.e. the only one on its path that is not split.
+static uint8_t buddyFind(BuddyTree const *tree, uint8_t leaf){
+	uint8_t level = buddyTopLevel(tree, leaf);
+	while (level > 0 && buddyTest(tree->splitBits, buddyBit(tree, level, leaf >> level)))
+	{
+		level--;
+	}
+	return level;
+}
+
+// Returns the lowest level whose blocks can hold the given number of bytes or HEAP_BUDDY_LEVELS if there is none.
+static uint8_t buddyLevelFor(BuddyTree const *tree, MemSize size){
+	uint8_t level = 0;
+	while (level < HEAP_BUDDY_LEVELS && (tree->leafCount >> level) > 0 && buddyBlockSize(tree, level) < size)
+	{
+		level++;
+	}
+	if (level == HEAP_BUDDY_LEVELS || (tree->leafCount >> level) == 0)
+	{
+		return HEAP_BUDDY_LEVELS;
+	}
+	return level;
+}
+
+// Returns the position of the lowest set bit of a byte at or above the given position or 8 if there is none.
+static uint8_t lowestBitFrom(uint8_t byte, uint8_t pos){
+	if (pos >= 8)
+	{
+		return 8;
+	}
+	byte >>= pos;
+	if (byte == 0)
+	{
+		return 8;
+	}
+	while (!(byte & 1))
+	{
+		byte >>= 1;
+		pos++;
+	}
+	return pos;
+}
+
+// Returns the first set bit of the free bits at or behind the given one or 0xFFFF if there is none.
+static uint16_t buddyNextFree(BuddyTree const *tree, uint16_t bit){
+	uint8_t byte = bit / 8;
+	uint8_t pos = lowestBitFrom(tree->freeBits[byte], bit % 8);
+	if (pos < 8)
+	{
+		return 8 * byte + pos;
+	}
+	// the next byte that is not 0, found in the summary byte that covers it or through the top byte
+	byte++;
+	uint8_t summary = byte / 8;
+	pos = (summary < HEAP_BUDDY_SUMMARY) ? lowestBitFrom(tree->freeSummary[summary], byte % 8) : 8;
+	if (pos == 8)
+	{
+		summary = lowestBitFrom(tree->freeTop, summary + 1);
+		if (summary == 8)
+		{
+			return 0xFFFF;
+		}
+		pos = lowestBitFrom(tree->freeSummary[summary], 0);
+	}
+	byte = 8 * summary + pos;
+	return 8 * byte + lowestBitFrom(tree->freeBits[byte], 0);
+}
+
+// Returns the first free block on the given level or the number of blocks on that level if there is none.
+static uint8_t buddyFirstFree(BuddyTree const *tree, uint8_t level){
+	uint16_t const first = buddyBit(tree, level, 0);
+	uint16_t const end = first + (tree->leafCount >> level);
+	uint16_t const bit = buddyNextFree(tree, first);
+	return (bit < end) ? bit - first : end - first;
+}
+
+// Frees a block and merges it with its buddy as long as that is free as well.
+static void buddyMerge(BuddyTree *tree, uint8_t level, uint8_t i){
+	while (level + 1 < HEAP_BUDDY_LEVELS && (i >> 1) < (tree->leafCount >> (level + 1))
+		&& buddyTest(tree->freeBits, buddyBit(tree, level, i ^ 1)))
+	{
+		buddySetFree(tree, level, i ^ 1, false);
+		level++;
+		i >>= 1;
+		buddyAssign(tree->splitBits, buddyBit(tree, level, i), false);
+	}
+	buddySetFree(tree, level, i, true);
+}
+
+// Marks the blocks of the given range as free iff their map entries are all free.
+static void buddyBuild(Heap *heap, uint8_t level, uint8_t i){
+	BuddyTree *tree = &heap->buddy;
+	MemAddr start = heap->useStart + ((MemAddr)i << level << tree->blockShift);
+	MemAddr end = start + buddyBlockSize(tree, level);
+	if (os_scanMap(heap, start, end, 0, false) == end)
+	{
+		buddySetFree(tree, level, i, true);
+	}else if (level == 0)
+	{
+		buddyAssign(tree->splitBits, buddyBit(tree, 0, i), true);
+	}else{
+		buddyAssign(tree->splitBits, buddyBit(tree, level, i), true);
+		buddyBuild(heap, level - 1, 2 * i);
+		buddyBuild(heap, level - 1, 2 * i + 1);
+	}
+}
+
+// Builds the buddy tree of the heap from its map.
+void os_Memory_BuddyRebuild(Heap *heap){
+	BuddyTree *tree = &heap->buddy;
+	if (tree->blockShift == 0)
+	{
+		return;
+	}
+	uint16_t const bytes = (buddyBit(tree, HEAP_BUDDY_LEVELS, 0) + 7) / 8;
+	for (uint16_t b = 0; b < bytes; b++)
+	{
+		tree->freeBits[b] = 0;
+		tree->splitBits[b] = 0;
+	}
+	for (uint8_t k = 0; k < HEAP_BUDDY_LEVELS; k++)
+	{
+		tree->freeCount[k] = 0;
+	}
+	for (uint8_t s = 0; s < HEAP_BUDDY_SUMMARY; s++)
+	{
+		tree->freeSummary[s] = 0;
+	}
+	tree->freeTop = 0;
+	for (uint16_t leaf = 0; leaf < tree->leafCount; leaf += 1 << buddyTopLevel(tree, leaf))
+	{
+		uint8_t level = buddyTopLevel(tree, leaf);
+		buddyBuild(heap, level, leaf >> level);
+	}
+}
+
+MemAddr os_Memory_Buddy(Heap *heap, MemSize size){
+	BuddyTree const *tree = &heap->buddy;
+	if (tree->blockShift == 0)
+	{
 		return 0;
 	}
-	
-	return heap->useStart + bestInd;
+	for (uint8_t level = buddyLevelFor(tree, size); level < HEAP_BUDDY_LEVELS; level++)
+	{
+		if (tree->freeCount[level] == 0)
+		{
+			continue;
+		}
+		uint8_t const i = buddyFirstFree(tree, level);
+		if (i < (tree->leafCount >> level))
+		{
+			return heap->useStart + ((MemAddr)i << level << tree->blockShift);
+		}
+	}
+	return 0;
 }
 
-MemAddr os_Memory_WorstFit(Heap *heap, size_t size)
-{
-	MemAddr worstInd = 0;
-	size_t worstArea = 0;
-	
-	for (size_t i = 0; i < heap->useSize;)
-	{
-		size_t currSize = 0;
-		for (size_t j = i; j < heap->useSize; j++) {
-			MemValue val = os_getMapEntry(heap, heap->useStart + j);
-			
-			if  (val != 0)
+// Takes the block starting at the given address out of the tree, after splitting it down to the size of the chunk.
+void os_Memory_BuddyClaim(Heap *heap, MemAddr start, MemSize size){
+	BuddyTree *tree = &heap->buddy;
+	MemAddr const offset = start - heap->useStart;
+	uint8_t const leaf = offset >> tree->blockShift;
+	if (tree->blockShift == 0 || leaf >= tree->leafCount)
+	{
+		return;
+	}
+	uint8_t level = buddyFind(tree, leaf);
+	if (!buddyTest(tree->freeBits, buddyBit(tree, level, leaf >> level)))
+	{
+		return;
+	}
+	buddySetFree(tree, level, leaf >> level, false);
+	uint8_t const target = buddyLevelFor(tree, size);
+	while (level > target)
+	{
+		buddyAssign(tree->splitBits, buddyBit(tree, level, leaf >> level), true);
+		level--;
+		buddySetFree(tree, level, (leaf >> level) ^ 1, true);
+	}
+}
+
+// Gives the block of a freed chunk back to the tree, ranges within a block are ignored.
+void os_Memory_BuddyRelease(Heap *heap, MemAddr start, MemSize size){
+	BuddyTree *tree = &heap->buddy;
+	MemAddr const offset = start - heap->useStart;
+	uint8_t leaf = offset >> tree->blockShift;
+	if (tree->blockShift == 0 || leaf >= tree->leafCount)
+	{
+		return;
+	}
+	uint8_t const level = buddyFind(tree, leaf);
+	if (level == 0 && buddyTest(tree->splitBits, buddyBit(tree, 0, leaf)))
+	{
+		// pinned blocks are given back as soon as the map shows them as free
+		MemAddr blockStart = heap->useStart + ((MemAddr)leaf << tree->blockShift);
+		while (leaf < tree->leafCount && blockStart < start + size && buddyTest(tree->splitBits, buddyBit(tree, 0, leaf)))
+		{
+			MemAddr const blockEnd = blockStart + buddyBlockSize(tree, 0);
+			if (os_scanMap(heap, blockStart, blockEnd, 0, false) == blockEnd)
 			{
-				break;
+				buddyAssign(tree->splitBits, buddyBit(tree, 0, leaf), false);
+				buddyMerge(tree, 0, leaf);
 			}
-			currSize++;
+			leaf++;
+			blockStart = blockEnd;
 		}
-		if (currSize >= heap->useSize / 2)
+		return;
+	}
+	if (offset % buddyBlockSize(tree, level) == 0 && !buddyTest(tree->freeBits, buddyBit(tree, level, leaf >> level)))
+	{
+		buddyMerge(tree, level, leaf >> level);
+	}
+}
+
+/* The TLSF (two-level segregated fit) strategy keeps one free list per size class. The first level splits
+ * the sizes into powers of two and the second level splits each of them into TLSF_LISTS_PER_CLASS ranges.
+ * Two bitmaps tell which lists are not empty, so finding a fitting list, allocating and freeing a block
+ * take constant time. The links of a free block are stored in the block itself, in fields of HEAP_FIELD_SIZE bytes:
+ *
+ *   start + 0: size, start + F: next free block, start + 2F: previous free block, end - F: size
+ *
+ * Free ranges shorter than TLSF_MIN_BLOCK cannot hold these and are not listed. Such a fragment always
+ * lies between two chunks and is merged as soon as one of them is freed, so every maximal free range of
+ * the map is either exactly one listed block or a fragment.
+ */
+#if MEM_WIDE_ADDRESSES
+#define TLSF_MIN_SHIFT 4
+#else
+#define TLSF_MIN_SHIFT 3
+#endif
+#define TLSF_MIN_BLOCK (1 << TLSF_MIN_SHIFT)
+
+// Returns the position of the highest set bit of a value that is not 0.
+static uint8_t tlsfHighestBit(MemSize value){
+	uint8_t bit = 8 * sizeof(MemSize) - 1;
+	while (!(value & ((MemSize)1 << bit)))
+	{
+		bit--;
+	}
+	return bit;
+}
+
+// Returns the position of the lowest set bit of a value that is not 0.
+static uint8_t tlsfLowestBit(uint16_t value){
+	uint8_t bit = 0;
+	while (!(value & (1u << bit)))
+	{
+		bit++;
+	}
+	return bit;
+}
+
+// Returns the free list of blocks of the given size as first-level class * TLSF_LISTS_PER_CLASS + second-level class.
+static uint8_t tlsfList(MemSize size){
+	uint8_t const high = tlsfHighestBit(size);
+	uint8_t const second = (size >> (high - TLSF_SL_BITS)) & (TLSF_LISTS_PER_CLASS - 1);
+	return (high - TLSF_MIN_SHIFT) * TLSF_LISTS_PER_CLASS + second;
+}
+
+// Adds a free block to the front of its list.
+static void tlsfInsert(Heap *heap, MemAddr start, MemSize size){
+	TlsfIndex *index = &heap->tlsf;
+	uint8_t const list = tlsfList(size);
+	MemAddr const next = index->heads[list];
+	os_writeHeapField(heap, start, size);
+	os_writeHeapField(heap, start + HEAP_FIELD_SIZE, next);
+	os_writeHeapField(heap, start + 2 * HEAP_FIELD_SIZE, 0);
+	os_writeHeapField(heap, start + size - HEAP_FIELD_SIZE, size);
+	if (next != 0)
+	{
+		os_writeHeapField(heap, next + 2 * HEAP_FIELD_SIZE, start);
+	}
+	index->heads[list] = start;
+	index->classBitmap |= 1u << (list / TLSF_LISTS_PER_CLASS);
+	index->listBitmap[list / TLSF_LISTS_PER_CLASS] |= 1u << (list % TLSF_LISTS_PER_CLASS);
+}
+
+// Removes a free block from its list.
+static void tlsfRemove(Heap *heap, MemAddr start, MemSize size){
+	TlsfIndex *index = &heap->tlsf;
+	uint8_t const list = tlsfList(size);
+	MemAddr const next = os_readHeapField(heap, start + HEAP_FIELD_SIZE);
+	MemAddr const prev = os_readHeapField(heap, start + 2 * HEAP_FIELD_SIZE);
+	if (prev != 0)
+	{
+		os_writeHeapField(heap, prev + HEAP_FIELD_SIZE, next);
+	}else{
+		index->heads[list] = next;
+	}
+	if (next != 0)
+	{
+		os_writeHeapField(heap, next + 2 * HEAP_FIELD_SIZE, prev);
+	}
+	if (index->heads[list] == 0)
+	{
+		index->listBitmap[list / TLSF_LISTS_PER_CLASS] &= ~(1u << (list % TLSF_LISTS_PER_CLASS));
+		if (index->listBitmap[list / TLSF_LISTS_PER_CLASS] == 0)
 		{
-			return heap->useStart + i;
+			index->classBitmap &= ~(1u << (list / TLSF_LISTS_PER_CLASS));
 		}
-		if (currSize > size && currSize > worstArea)
+	}
+}
+
+// Builds the free lists of the heap from its map.
+void os_Memory_TlsfRebuild(Heap *heap){
+	TlsfIndex *index = &heap->tlsf;
+	if (index->classCount == 0)
+	{
+		return;
+	}
+	index->classBitmap = 0;
+	for (uint8_t f = 0; f < index->classCount; f++)
+	{
+		index->listBitmap[f] = 0;
+		for (uint8_t s = 0; s < TLSF_LISTS_PER_CLASS; s++)
+		{
+			index->heads[f * TLSF_LISTS_PER_CLASS + s] = 0;
+		}
+	}
+	FreeExtent extent;
+	MemAddr from = heap->useStart;
+	// the free-extent list is suspended while the TLSF strategy is in use, so this scans the map
+	while (os_nextFreeExtent(heap, from, TLSF_MIN_BLOCK, &extent))
+	{
+		if (extent.length >= TLSF_MIN_BLOCK)
 		{
-			worstInd = i;
-			worstArea = currSize;
+			tlsfInsert(heap, extent.start, extent.length);
 		}
-		
-		
-		i += currSize + 1;
+		from = extent.start + extent.length;
+	}
+}
+
+MemAddr os_Memory_Tlsf(Heap *heap, MemSize size){
+	TlsfIndex const *index = &heap->tlsf;
+	if (index->classCount == 0)
+	{
+		return 0;
+	}
+	if (size < TLSF_MIN_BLOCK)
+	{
+		size = TLSF_MIN_BLOCK;
+	}
+	// every block of the list found for the rounded size is large enough
+	MemSize const rounded = size + ((MemSize)1 << (tlsfHighestBit(size) - TLSF_SL_BITS)) - 1;
+	if (rounded > size)
+	{
+		uint8_t const list = tlsfList(rounded);
+		uint8_t f = list / TLSF_LISTS_PER_CLASS;
+		if (f < index->classCount)
+		{
+			uint8_t lists = index->listBitmap[f] & (0xFF << (list % TLSF_LISTS_PER_CLASS));
+			if (lists == 0)
+			{
+				uint16_t const classes = index->classBitmap & ~((2u << f) - 1);
+				if (classes != 0)
+				{
+					f = tlsfLowestBit(classes);
+					lists = index->listBitmap[f];
+				}
+			}
+			if (lists != 0)
+			{
+				return index->heads[f * TLSF_LISTS_PER_CLASS + tlsfLowestBit(lists)];
+			}
+		}
+	}
+	// the first block of the list of the exact size may still fit
+	uint8_t const list = tlsfList(size);
+	MemAddr const head = (list / TLSF_LISTS_PER_CLASS < index->classCount) ? index->heads[list] : 0;
+	if (head != 0 && os_readHeapField(heap, head) >= size)
+	{
+		return head;
 	}
-	
-	
-	
-	if (worstArea == 0)
+	return 0;
+}
+
+/* Takes the block starting at the given address out of its list and lists what remains after the chunk.
+ * Returns the size of the block.
+ */
+MemSize os_Memory_TlsfClaim(Heap *heap, MemAddr start, MemSize size){
+	if (heap->tlsf.classCount == 0)
 	{
 		return 0;
 	}
-	
-	return heap->useStart + worstInd;
-}
\ No newline at end of file
+	MemSize const blockSize = os_readHeapField(heap, start);
+	tlsfRemove(heap, start, blockSize);
+	if (blockSize >= size + TLSF_MIN_BLOCK)
+	{
+		tlsfInsert(heap, start + size, blockSize - size);
+	}
+	return blockSize;
+}
+
+/* Lists a range that has just been freed after merging it with the free ranges around it.
+ * Returns the size of the merged range.
+ */
+MemSize os_Memory_TlsfRelease(Heap *heap, MemAddr start, MemSize size){
+	if (heap->tlsf.classCount == 0)
+	{
+		return 0;
+	}
+	MemAddr const useEnd = heap->useStart + heap->useSize;
+	MemAddr end = start + size;
+	// a free range in front is a listed block iff it is not shorter than TLSF_MIN_BLOCK
+	uint8_t before = 0;
+	while (before < TLSF_MIN_BLOCK && start - before > heap->useStart && os_getMapEntry(heap, start - before - 1) == 0)
+	{
+		before++;
+	}
+	if (before == TLSF_MIN_BLOCK)
+	{
+		MemSize const prevSize = os_readHeapField(heap, start - HEAP_FIELD_SIZE);
+		tlsfRemove(heap, start - prevSize, prevSize);
+		start -= prevSize;
+	}else{
+		start -= before;
+	}
+	// the same holds for a free range behind
+	MemAddr const behindEnd = (useEnd - end > TLSF_MIN_BLOCK) ? end + TLSF_MIN_BLOCK : useEnd;
+	uint8_t const behind = os_scanMap(heap, end, behindEnd, 0, false) - end;
+	if (behind == TLSF_MIN_BLOCK)
+	{
+		MemSize const nextSize = os_readHeapField(heap, end);
+		tlsfRemove(heap, end, nextSize);
+		end += nextSize;
+	}else{
+		end += behind;
+	}
+	if (end - start >= TLSF_MIN_BLOCK)
+	{
+		tlsfInsert(heap, start, end - start);
+	}
+	return end - start;
+}
+
+// Returns the size of the largest listed block, 0 if there is none. Only the highest list that is not empty is walked.
+MemSize os_Memory_TlsfLargest(Heap const *heap){
+	TlsfIndex const *index = &heap->tlsf;
+	if (index->classBitmap == 0)
+	{
+		return 0;
+	}
+	uint8_t const f = tlsfHighestBit(index->classBitmap);
+	uint8_t const list = f * TLSF_LISTS_PER_CLASS + tlsfHighestBit(index->listBitmap[f]);
+	MemSize largest = 0;
+	for (MemAddr block = index->heads[list]; block != 0; block = os_readHeapField(heap, block + HEAP_FIELD_SIZE))
+	{
+		MemSize const size = os_readHeapField(heap, block);
+		if (size > largest)
+		{
+			largest = size;
+		}
+	}
+	return largest;
+}
+
+// Throws away the bookkeeping the strategy of the heap keeps besides the map and rebuilds it from the map.
+void os_Memory_ResetStrategy(Heap *heap){
+	os_Memory_SlabDissolve(heap, false);
+	switch (heap->strategy)
+	{
+		case OS_MEM_BUDDY:
+			os_Memory_BuddyRebuild(heap);
+			break;
+		case OS_MEM_TLSF:
+			os_Memory_TlsfRebuild(heap);
+			break;
+		default:
+			break;
+	}
+}
@@ -3,12 +3,40 @@
 
 #include "os_memheap_drivers.h"
 
-MemAddr os_Memory_FirstFit(Heap *heap, size_t size);
+MemAddr os_Memory_FirstFit(Heap *heap, MemSize size);
 
-MemAddr os_Memory_NextFit(Heap *heap, size_t size);
+MemAddr os_Memory_NextFit(Heap *heap, MemSize size);
 
-MemAddr os_Memory_BestFit(Heap *heap, size_t size);
+MemAddr os_Memory_BestFit(Heap *heap, MemSize size);
 
-MemAddr os_Memory_WorstFit(Heap *heap, size_t size);
+MemAddr os_Memory_WorstFit(Heap *heap, MemSize size);
+
+MemAddr os_Memory_Slab(Heap *heap, MemSize size);
+
+void os_Memory_SlabClaim(Heap *heap, MemAddr addr);
+
+void os_Memory_SlabRelease(Heap *heap, MemAddr addr);
+
+void os_Memory_SlabDissolve(Heap *heap, bool emptyOnly);
+
+MemAddr os_Memory_Buddy(Heap *heap, MemSize size);
+
+void os_Memory_BuddyClaim(Heap *heap, MemAddr start, MemSize size);
+
+void os_Memory_BuddyRelease(Heap *heap, MemAddr start, MemSize size);
+
+void os_Memory_BuddyRebuild(Heap *heap);
+
+MemAddr os_Memory_Tlsf(Heap *heap, MemSize size);
+
+MemSize os_Memory_TlsfClaim(Heap *heap, MemAddr start, MemSize size);
+
+MemSize os_Memory_TlsfRelease(Heap *heap, MemAddr start, MemSize size);
+
+MemSize os_Memory_TlsfLargest(Heap const *heap);
+
+void os_Memory_TlsfRebuild(Heap *heap);
+
+void os_Memory_ResetStrategy(Heap *heap);
 
 #endif
\ No newline at end of file
@@ -35,7 +35,9 @@ typedef enum ProcessState {
     OS_PS_UNUSED,
     OS_PS_READY,
     OS_PS_RUNNING,
-    OS_PS_BLOCKED
+    OS_PS_BLOCKED,   // gave its time slice away with os_yield, ready again after the next switch
+    OS_PS_WAITING,   // sleeps in a wait queue until a semaphore or mutex wakes it up, see os_sync.h
+    OS_PS_SLEEPING   // sleeps until the time given to os_sleep or os_sleepUntil is reached
 } ProcessState;
 
 //! A union that holds the current stack pointer of a given process.
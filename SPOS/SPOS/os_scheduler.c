@@ -18,7 +18,10 @@
 #include "lcd.h"
 #include "os_memheap_drivers.h"
 #include "os_memory.h"
+#include "os_sync.h"
+#include "os_spi.h"
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <stdbool.h>
 
 //----------------------------------------------------------------------------
@@ -45,6 +48,50 @@ SchedulingStrategy currentStrategy;
 //! Count of currently nested critical sections
 uint8_t criticalSectionCount;
 
+//! Time the idle process spent asleep since the last os_resetSleepStats (in Timer 0 counts)
+Time sleepTicks;
+
+//! System time of the last os_resetSleepStats (in Timer 0 counts)
+Time sleepStatsStart;
+
+//! System time the idle process fell asleep at (in Timer 0 counts)
+Time sleepStart;
+
+//! Whether the idle process is asleep
+bool idleAsleep;
+
+//! Most bytes every process stack used so far, found by the idle process
+uint16_t stackHighWater[MAX_NUMBER_OF_PROCESSES];
+
+//! Timer 0 counts per ms, the same factor os_systemTime_precise divides by
+#define TC0_COUNTS_PER_MS (F_CPU / (TC0_PRESCALER * 1000ul))
+
+//! Timer 0 counts per Timer 2 count, their prescalers are 256 and 1024
+#define TC0_COUNTS_PER_TC2_COUNT (1024 / TC0_PRESCALER)
+
+//! Ends the list of sleeping processes
+#define WAKE_UP_LIST_END INVALID_PROCESS
+
+//! Sleeping process that wakes up next, the head of a delta list ordered by wake-up time
+ProcessID wakeUpHead = WAKE_UP_LIST_END;
+
+//! Sleeping process that wakes up after the given one
+ProcessID wakeUpNext[MAX_NUMBER_OF_PROCESSES];
+
+//! Timer 0 counts between the wake-up of the previous process in the list (for the head: wakeUpsAdvanced) and the one of the given process
+Time wakeUpDelta[MAX_NUMBER_OF_PROCESSES];
+
+//! System time the list of sleeping processes was advanced to (in Timer 0 counts)
+Time wakeUpsAdvanced;
+
+#if STACK_PROTECTION == STACK_PROTECTION_SAMPLED
+//! Number of switches until the next checksum is taken
+uint8_t stackCheckCountdown = STACK_CHECK_INTERVAL;
+
+//! Processes whose checksum was taken when they were suspended the last time
+ProcessMask stackChecksumTaken;
+#endif
+
 //----------------------------------------------------------------------------
 // Private function declarations
 //----------------------------------------------------------------------------
@@ -56,6 +103,136 @@ ISR(TIMER2_COMPA_vect) __attribute__((naked));
 // Function definitions
 //----------------------------------------------------------------------------
 
+// Adds the time since the idle process fell asleep to the sleep statistics. Interrupts have to be disabled.
+static void os_accountSleep(void) {
+	if (idleAsleep) {
+		sleepTicks += os_systemTime_ticks() - sleepStart;
+		idleAsleep = false;
+	}
+}
+
+// Returns whether the canary at the limit of the stack of a process is intact.
+static bool os_canaryIntact(ProcessID pid) {
+	return *(uint16_t const*)PROCESS_STACK_LIMIT(pid) == STACK_CANARY;
+}
+
+// Records what is needed to check the stack of a process that is suspended when it is resumed.
+static void os_protectStack(ProcessID pid) {
+#if STACK_PROTECTION == STACK_PROTECTION_CHECKSUM
+	os_processes[pid].checksum = os_getStackChecksum(pid);
+#elif STACK_PROTECTION == STACK_PROTECTION_SAMPLED
+	if (--stackCheckCountdown == 0) {
+		stackCheckCountdown = STACK_CHECK_INTERVAL;
+		os_processes[pid].checksum = os_getStackChecksum(pid);
+		stackChecksumTaken |= (ProcessMask)1 << pid;
+	}
+#elif STACK_PROTECTION == STACK_PROTECTION_CANARY
+	// the process that just ran is the one that can have overflown
+	if (pid != 0 && os_processes[pid].state != OS_PS_UNUSED && !os_canaryIntact(pid)) {
+		os_error("stack overflow");
+	}
+#endif
+}
+
+// Checks the stack of a process that is about to be resumed.
+static void os_checkStack(ProcessID pid) {
+#if STACK_PROTECTION == STACK_PROTECTION_CHECKSUM
+	if (os_getStackChecksum(pid) != os_processes[pid].checksum) {
+		os_error("checksum changed!");
+	}
+#elif STACK_PROTECTION == STACK_PROTECTION_SAMPLED
+	ProcessMask const bit = (ProcessMask)1 << pid;
+	if (stackChecksumTaken & bit) {
+		stackChecksumTaken &= ~bit;
+		if (os_getStackChecksum(pid) != os_processes[pid].checksum) {
+			os_error("checksum changed!");
+		}
+	}
+#elif STACK_PROTECTION == STACK_PROTECTION_CANARY
+	if (!os_canaryIntact(pid)) {
+		os_error("stack overflow");
+	}
+#endif
+}
+
+// Updates the high-water marks of all stacks by counting the painted bytes above their canaries.
+static void os_scanStacks(void) {
+	for (ProcessID pid = 0; pid < MAX_NUMBER_OF_PROCESSES; pid++) {
+		// os_exec must not repaint the stack while it is scanned
+		os_enterCriticalSection();
+		if (os_processes[pid].state != OS_PS_UNUSED) {
+			if (!os_canaryIntact(pid)) {
+				os_error("stack overflow");
+			}
+			uint8_t const* limit = (uint8_t const*)PROCESS_STACK_LIMIT(pid);
+			uint16_t unused = sizeof(uint16_t);
+			while (unused < STACK_SIZE_PROC && limit[unused] == STACK_PAINT) {
+				unused++;
+			}
+			if (STACK_SIZE_PROC - unused > stackHighWater[pid]) {
+				stackHighWater[pid] = STACK_SIZE_PROC - unused;
+			}
+		}
+		os_leaveCriticalSection();
+	}
+}
+
+/* Advances the list of sleeping processes to the current system time and makes every process whose time is up ready.
+ * Only the head of the list is touched, so a tick costs the same no matter how many processes sleep.
+ */
+static void os_advanceWakeUps(void) {
+	Time const now = os_systemTime_ticks();
+	Time elapsed = now - wakeUpsAdvanced;
+	wakeUpsAdvanced = now;
+	while (wakeUpHead != WAKE_UP_LIST_END && wakeUpDelta[wakeUpHead] <= elapsed) {
+		ProcessID const pid = wakeUpHead;
+		elapsed -= wakeUpDelta[pid];
+		wakeUpHead = wakeUpNext[pid];
+		os_processes[pid].state = OS_PS_READY;
+		os_readySetAdd(pid);
+	}
+	if (wakeUpHead != WAKE_UP_LIST_END) {
+		wakeUpDelta[wakeUpHead] -= elapsed;
+	}
+}
+
+// Takes a sleeping process that is about to be killed out of the list of sleeping processes.
+static void os_cancelWakeUp(ProcessID pid) {
+	for (ProcessID *link = &wakeUpHead; *link != WAKE_UP_LIST_END; link = &wakeUpNext[*link]) {
+		if (*link == pid) {
+			// the following process inherits the time the removed one waited for
+			*link = wakeUpNext[pid];
+			if (*link != WAKE_UP_LIST_END) {
+				wakeUpDelta[*link] += wakeUpDelta[pid];
+			}
+			return;
+		}
+	}
+}
+
+// Lets the current process sleep for the given number of Timer 0 counts.
+static void os_sleepCounts(Time counts) {
+	os_enterCriticalSection();
+	ProcessID const self = currentProc;
+	// the deltas count from the last time the list was advanced
+	Time delta = os_systemTime_ticks() - wakeUpsAdvanced + counts;
+	ProcessID *link = &wakeUpHead;
+	while (*link != WAKE_UP_LIST_END && wakeUpDelta[*link] <= delta) {
+		delta -= wakeUpDelta[*link];
+		link = &wakeUpNext[*link];
+	}
+	if (*link != WAKE_UP_LIST_END) {
+		wakeUpDelta[*link] -= delta;
+	}
+	wakeUpNext[self] = *link;
+	wakeUpDelta[self] = delta;
+	*link = self;
+	os_processes[self].state = OS_PS_SLEEPING;
+	os_readySetRemove(self);
+	os_yield();
+	os_leaveCriticalSection();
+}
+
 void setCurrentProc(void){
 	if (currentStrategy == OS_SS_EVEN)
 	{
@@ -97,12 +274,21 @@ ISR(TIMER2_COMPA_vect) {
 	//4. Setzen des SP-Registers auf den Scheduler-Stack
 	SP = BOTTOM_OF_ISR_STACK;
 	
+	// Whatever woke the idle process, its sleep is over
+	os_accountSleep();
+	
 	// Aufruf des Taskmanagers
 	if (os_getInput() == 0b00001001) {
 		os_waitForNoInput();
 		os_taskManMain(); 
 	}
 	
+	// Aufwecken der Prozesse, deren Schlafenszeit abgelaufen ist
+	os_advanceWakeUps();
+	
+	// Processes whose SPI transfer was done within a critical section could not be woken up then
+	os_spi_wakeWaiters();
+	
 	//5. Setzen des Prozesszustandes des aktuellen Prozesses auf OS_PS_READY
 	if (os_processes[currentProc].state == OS_PS_RUNNING)
 	{
@@ -111,8 +297,8 @@ ISR(TIMER2_COMPA_vect) {
 	
 	ProcessID prevProc = currentProc;
 	
-	//checksum abspeichern
-	os_processes[currentProc].checksum = os_getStackChecksum(currentProc);
+	// Schutz des Prozessstacks gem STACK_PROTECTION vorbereiten
+	os_protectStack(currentProc);
 	
 	//6. Auswahl des nchsten fortzusetzenden Prozesses
 	setCurrentProc();
@@ -120,12 +306,30 @@ ISR(TIMER2_COMPA_vect) {
 	if (os_processes[prevProc].state == OS_PS_BLOCKED)
 	{
 		os_processes[prevProc].state = OS_PS_READY;
+		os_readySetAdd(prevProc);
 	}
 	
-	// checksum check
-	if (os_getStackChecksum(currentProc) != os_processes[currentProc].checksum) {
-		os_error("checksum changed!");
+#if SCHEDULER_TICKLESS_IDLE
+	// While nobody but the idle process can run, there is nothing to switch to until the next sleeping process wakes up, so the ticks are stretched
+	uint8_t compare = SCHEDULER_TICK_COMPARE;
+	if (currentProc == 0 && os_getReadyMask() == 1) {
+		compare = SCHEDULER_IDLE_TICK_COMPARE;
+		if (wakeUpHead != WAKE_UP_LIST_END && wakeUpDelta[wakeUpHead] / TC0_COUNTS_PER_TC2_COUNT < SCHEDULER_IDLE_TICK_COMPARE) {
+			uint8_t const wakeUp = wakeUpDelta[wakeUpHead] / TC0_COUNTS_PER_TC2_COUNT;
+			compare = wakeUp > SCHEDULER_TICK_COMPARE ? wakeUp : SCHEDULER_TICK_COMPARE;
+		}
 	}
+	if (OCR2A != compare) {
+		OCR2A = compare;
+		// os_yield calls us in the middle of a tick, so the counter may already be past the shorter compare value
+		if (TCNT2 >= compare) {
+			TCNT2 = 0;
+		}
+	}
+#endif
+	
+	// Prozessstack gem STACK_PROTECTION prfen
+	os_checkStack(currentProc);
 	
 	//7. Setzen des Prozesszustandes des fortzusetzenden Prozesses auf OS_PS_RUNNING
 	os_processes[currentProc].state = OS_PS_RUNNING;
@@ -142,10 +346,46 @@ ISR(TIMER2_COMPA_vect) {
  *  and processor time no other process wants to have.
  */
 void idle(void) {
+#if SCHEDULER_TICKLESS_IDLE
+	Time lastDot = os_systemTime_coarse();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
     while (1)
     {
+#if SCHEDULER_TICKLESS_IDLE
+		// Sleep until the next interrupt. Timer 0 keeps running in idle mode, so the system time needs no catching up.
+		// Interrupts are only enabled by the instruction before sleep_cpu, so a wake-up cannot get lost in between.
+		cli();
+		sleepStart = os_systemTime_ticks();
+		idleAsleep = true;
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+		os_accountSleep();
+		sei();
+		// A process woken up by an interrupt, e.g. at the end of a SPI transfer, need not wait for the stretched tick
+		if (os_getReadyMask() != 1)
+		{
+			os_yield();
+		}
+		if (os_systemTime_coarse() - lastDot < DEFAULT_OUTPUT_DELAY)
+		{
+			continue;
+		}
+		lastDot = os_systemTime_coarse();
+#endif
+		// use the spare time to move relocatable chunks together and to look after the stacks
+		for (uint8_t i = 0; i < os_getHeapListLength(); ++i)
+		{
+			os_compactHeap(os_lookupHeap(i));
+		}
+		os_scanStacks();
 		lcd_writeString(".");
+#if !SCHEDULER_TICKLESS_IDLE
 		delayMs(DEFAULT_OUTPUT_DELAY);
+#endif
     }
 }
 
@@ -162,10 +402,19 @@ bool os_kill(ProcessID pid){
 		os_leaveCriticalSection();
 		return false;
 	}
+	os_cancelWait(pid);
+	if (os_processes[pid].state == OS_PS_SLEEPING)
+	{
+		os_cancelWakeUp(pid);
+	}
+	// the external SRAM is given back first as it has to finish the transfer of the process before its mutex is unlocked
+	os_releaseMemoryDevices(pid);
+	os_mutex_abandonAll(pid);
 	if (pid == os_getCurrentProc())
 	{
 		os_processes[pid].state = OS_PS_UNUSED;	
 		os_processes[pid].program = NULL;
+		os_readySetRemove(pid);
 		for (uint8_t i = 0; i < os_getHeapListLength(); ++i)
 		{
 			os_freeProcessMemory(os_lookupHeap(i), pid);
@@ -179,6 +428,7 @@ bool os_kill(ProcessID pid){
 	{
 		os_processes[pid].state = OS_PS_UNUSED;
 		os_processes[pid].program = NULL;
+		os_readySetRemove(pid);
 		for (uint8_t i = 0; i < os_getHeapListLength(); ++i)
 		{
 			os_freeProcessMemory(os_lookupHeap(i), pid);
@@ -262,9 +512,19 @@ ProcessID os_exec(Program *program, Priority priority) {
 	}
 	// der Stackpointer des neuen Prozesses auf die nun erste freie Speicherstelle des Prozessstacks gesetzt werden
 	os_processes[PID].sp.as_ptr = sp.as_ptr;
+	// den freien Teil des Prozessstacks markieren, damit der Leerlaufprozess die Ausnutzung findet, und den Canary setzen
+	*(uint16_t*)PROCESS_STACK_LIMIT(PID) = STACK_CANARY;
+	for (uint8_t *paint = (uint8_t*)PROCESS_STACK_LIMIT(PID) + sizeof(uint16_t); paint <= sp.as_ptr; paint++) {
+		*paint = STACK_PAINT;
+	}
+	stackHighWater[PID] = 0;
+#if STACK_PROTECTION == STACK_PROTECTION_SAMPLED
+	stackChecksumTaken &= ~((ProcessMask)1 << PID);
+#endif
 	// Prfsumme initialisieren
 	os_processes[PID].checksum = os_getStackChecksum(PID);
 	os_resetProcessSchedulingInformation(PID); // reset age of the new process
+	os_readySetAdd(PID);
 	os_leaveCriticalSection();
 	return PID;
 }
@@ -341,6 +601,47 @@ SchedulingStrategy os_getSchedulingStrategy(void) {
     return currentStrategy;
 }
 
+/*!
+ *  Returns the time the idle process spent asleep since the last call of os_resetSleepStats.
+ *  The counters stay at 0 unless SCHEDULER_TICKLESS_IDLE is set.
+ *
+ *  \return The sleep time in ms.
+ */
+Time os_getSleepTime(void) {
+	os_enterCriticalSection();
+	Time const ticks = sleepTicks;
+	os_leaveCriticalSection();
+	return ticks / (F_CPU / (TC0_PRESCALER * 1000ul));
+}
+
+/*!
+ *  Returns the fraction of the time since the last call of os_resetSleepStats
+ *  the idle process spent asleep.
+ *
+ *  \return The fraction in permille.
+ */
+uint16_t os_getSleepPermille(void) {
+	os_enterCriticalSection();
+	Time const ticks = sleepTicks;
+	Time const total = os_systemTime_ticks() - sleepStatsStart;
+	os_leaveCriticalSection();
+	// scaling the total down instead of the sleep time up avoids a 64 bit division
+	if (total < 1000) {
+		return 0;
+	}
+	return ticks / (total / 1000);
+}
+
+/*!
+ *  Restarts the sleep statistics, e.g. to measure the load of a specific phase.
+ */
+void os_resetSleepStats(void) {
+	os_enterCriticalSection();
+	sleepTicks = 0;
+	sleepStatsStart = os_systemTime_ticks();
+	os_leaveCriticalSection();
+}
+
 /*!
  *  Enters a critical code section by disabling the scheduler if needed.
  *  This function stores the nesting depth of critical sections of the current
@@ -383,6 +684,21 @@ void os_leaveCriticalSection(void) {
    SREG = sreg; // Wiederherstellen des (zuvor gespeicherten) Zustandes des Global Interrupt Enable Bit im SREG
 }
 
+/*!
+ *  Returns the most bytes the stack of a process used so far. The idle process
+ *  updates the value by looking for the first byte above the canary that is not
+ *  STACK_PAINT anymore, so it lags behind and may come out a little low.
+ *
+ *  \param pid The ID of the process.
+ *  \return The high-water mark of the stack in bytes.
+ */
+uint16_t os_getStackHighWater(ProcessID pid) {
+	os_enterCriticalSection();
+	uint16_t const highWater = stackHighWater[pid];
+	os_leaveCriticalSection();
+	return highWater;
+}
+
 /*!
  *  Calculates the checksum of the stack for a certain process.
  *
@@ -404,6 +720,7 @@ void os_yield(void) {
 	uint8_t sreg = SREG;
 	if (os_processes[currentProc].state == OS_PS_RUNNING || os_processes[currentProc].state == OS_PS_READY) {
 		os_processes[currentProc].state = OS_PS_BLOCKED;
+		os_readySetRemove(currentProc);
 	}
 	criticalSectionCount = 1;
 	os_leaveCriticalSection();
@@ -415,4 +732,40 @@ void os_yield(void) {
 	os_leaveCriticalSection();
 }
 
+/*!
+ *  Lets the current process sleep for some milliseconds. Unlike delayMs, the
+ *  process is not selected by any strategy in the meantime, so the processor
+ *  is left to the others. It is made ready in the first scheduler tick after
+ *  its time is up.
+ *  The idle process has to stay ready, so it waits with delayMs instead.
+ *
+ *  \param ms The time to sleep in ms.
+ */
+void os_sleep(Time ms) {
+	if (currentProc == 0) {
+		delayMs(ms);
+		return;
+	}
+	os_sleepCounts(ms * TC0_COUNTS_PER_MS);
+}
 
+/*!
+ *  Lets the current process sleep until the given system time, e.g. to run
+ *  periodically without drifting. Returns right away if the time has passed.
+ *
+ *  \param t The system time to wake up at in ms, as returned by os_systemTime_precise.
+ */
+void os_sleepUntil(Time t) {
+	os_enterCriticalSection();
+	// the difference also works if the system time wraps around in the meantime
+	Time const remaining = t * TC0_COUNTS_PER_MS - os_systemTime_ticks();
+	if ((int32_t)remaining > 0) {
+		if (currentProc == 0) {
+			os_leaveCriticalSection();
+			delayMs(remaining / TC0_COUNTS_PER_MS);
+			return;
+		}
+		os_sleepCounts(remaining);
+	}
+	os_leaveCriticalSection();
+}
@@ -15,6 +15,7 @@
 
 #include "defines.h"
 #include "os_process.h"
+#include "util.h"
 
 //----------------------------------------------------------------------------
 // Types
@@ -59,6 +60,18 @@ void os_setSchedulingStrategy(SchedulingStrategy strategy);
 //! Gets the current scheduling strategy
 SchedulingStrategy os_getSchedulingStrategy(void);
 
+//! Returns the time the idle process spent asleep since the last os_resetSleepStats in ms
+Time os_getSleepTime(void);
+
+//! Returns the fraction of the time since the last os_resetSleepStats the idle process spent asleep in permille
+uint16_t os_getSleepPermille(void);
+
+//! Restarts the sleep statistics
+void os_resetSleepStats(void);
+
+//! Returns the most bytes the stack of a process used so far
+uint16_t os_getStackHighWater(ProcessID pid);
+
 //! Calculates the checksum of the stack for the corresponding process of pid.
 StackChecksum os_getStackChecksum(ProcessID pid);
 
@@ -76,4 +89,10 @@ bool os_kill(ProcessID pid);
 
 void os_yield(void);
 
+//! Lets the current process sleep for some milliseconds without using the processor
+void os_sleep(Time ms);
+
+//! Lets the current process sleep until the given system time in ms (see os_systemTime_precise)
+void os_sleepUntil(Time t);
+
 #endif
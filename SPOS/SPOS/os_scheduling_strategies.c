@@ -16,10 +16,82 @@ The file contains five strategies:
 #include "os_core.h"
 
 #include <stdlib.h>
+#include <avr/pgmspace.h>
 
 // globale Variable
 SchedulingInformation schedulingInfo;
 
+// The processes that can be selected to run
+ReadySet readySet;
+
+// Index of the lowest set bit of every nibble (entry 0 is never read)
+static uint8_t PROGMEM const lowestBitOf[16] = {0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
+
+// Number of set bits of every nibble
+static uint8_t PROGMEM const bitCountOf[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+// Returns the index of the lowest set bit, mask must not be empty.
+static uint8_t lowestBit(ProcessMask mask) {
+	uint8_t base = 0;
+	while (!(mask & 0xF)) {
+		mask >>= 4;
+		base += 4;
+	}
+	return base + pgm_read_byte(&lowestBitOf[mask & 0xF]);
+}
+
+// Returns the number of set bits.
+static uint8_t bitCount(ProcessMask mask) {
+	uint8_t count = 0;
+	for (; mask; mask >>= 4) {
+		count += pgm_read_byte(&bitCountOf[mask & 0xF]);
+	}
+	return count;
+}
+
+// Returns the first process of mask after current, wrapping around to the lowest one. mask must not be empty.
+static ProcessID nextInMask(ProcessMask mask, ProcessID current) {
+	ProcessMask const later = mask & (ProcessMask)~((2u << current) - 1);
+	return lowestBit(later ? later : mask);
+}
+
+// Adds a process to the ready set.
+void os_readySetAdd(ProcessID pid) {
+	ProcessMask const bit = (ProcessMask)1 << pid;
+	readySet.all |= bit;
+	if (pid != 0) {
+		uint8_t const band = readySet.bandOf[pid];
+		readySet.bandMembers[band] |= bit;
+		readySet.bands |= 1 << band;
+	}
+}
+
+// Removes a process from the ready set.
+void os_readySetRemove(ProcessID pid) {
+	ProcessMask const bit = (ProcessMask)1 << pid;
+	readySet.all &= ~bit;
+	uint8_t const band = readySet.bandOf[pid];
+	readySet.bandMembers[band] &= ~bit;
+	if (!readySet.bandMembers[band]) {
+		readySet.bands &= ~(1 << band);
+	}
+}
+
+// Returns the processes that are ready or running.
+ProcessMask os_getReadyMask(void) {
+	return readySet.all;
+}
+
+// Moves a process to another priority band, it stays ready if it was before.
+void os_readySetMove(ProcessID pid, uint8_t band) {
+	bool const ready = readySet.all & ((ProcessMask)1 << pid);
+	os_readySetRemove(pid);
+	readySet.bandOf[pid] = band;
+	if (ready) {
+		os_readySetAdd(pid);
+	}
+}
+
 /*!
  *  Reset the scheduling information for a specific strategy
  *  This is only relevant for RoundRobin and InactiveAging
@@ -50,6 +122,7 @@ void os_resetSchedulingInformation(SchedulingStrategy strategy) {
 				schedulingInfo.zeitScheiben[i] = MLFQ_getDefaultTimeslice(MLFQ_MapToQueue(prio));
 				MLFQ_removePID(i);
 				pqueue_append(MLFQ_getQueue(MLFQ_MapToQueue(prio)), i);
+				os_readySetMove(i, MLFQ_MapToQueue(prio));
 			}
 		}
 	}
@@ -66,8 +139,12 @@ void os_resetProcessSchedulingInformation(ProcessID id) {
     schedulingInfo.age[id] = 0;
 	uint8_t prio = os_getProcessSlot(id)->priority;
 	schedulingInfo.zeitScheiben[id] = MLFQ_getDefaultTimeslice(MLFQ_MapToQueue(prio));
-	MLFQ_removePID(id);
-	pqueue_append(MLFQ_getQueue(MLFQ_MapToQueue(prio)), id);
+	os_readySetMove(id, MLFQ_MapToQueue(prio));
+	// the idle process only runs when every queue is empty
+	if (id != 0) {
+		MLFQ_removePID(id);
+		pqueue_append(MLFQ_getQueue(MLFQ_MapToQueue(prio)), id);
+	}
 }
 
 /*!
@@ -81,28 +158,12 @@ void os_resetProcessSchedulingInformation(ProcessID id) {
  *  \return The next process to be executed determined on the basis of the even strategy.
  */
 ProcessID os_Scheduler_Even(Process const processes[], ProcessID current) {
-	ProcessID i;
-	for(i = current + 1; i < MAX_NUMBER_OF_PROCESSES; ++i) {
-		if(processes[i].state == OS_PS_READY) {
-			return i;
-		}
-		if(processes[i].state == OS_PS_BLOCKED) {
-			os_getProcessSlot(i)->state = OS_PS_READY;
-		}
+	ProcessMask const ready = readySet.all & ~(ProcessMask)1;
+	if (!ready) {
+		// a process that yielded gets the processor back before the idle process does
+		return processes[current].state == OS_PS_BLOCKED ? current : 0;
 	}
-	for(i = 1 ; i <= MAX_NUMBER_OF_PROCESSES; ++i) {
-		if(processes[i].state == OS_PS_READY) {
-			return i;
-		}
-		if(processes[i].state == OS_PS_BLOCKED) {
-			os_getProcessSlot(i)->state = OS_PS_READY;
-		}
-	}
-	for(i = 1 ; i <= MAX_NUMBER_OF_PROCESSES; ++i) {
-		if(processes[i].state == OS_PS_READY) {
-			return i;}
-	}
-	return 0;
+	return nextInMask(ready, current);
 }
 
 
@@ -115,29 +176,26 @@ ProcessID os_Scheduler_Even(Process const processes[], ProcessID current) {
  *  \return The next process to be executed determined on the basis of the random strategy.
  */
 ProcessID os_Scheduler_Random(Process const processes[], ProcessID current) {
-    ProcessID readyProcesses[MAX_NUMBER_OF_PROCESSES];
-	int numReady = 0;
-	
-	for (int i = 1; i < MAX_NUMBER_OF_PROCESSES; i++)
+	ProcessMask ready = readySet.all & ~(ProcessMask)1;
+	if (!ready)
 	{
-		if (processes[i].state == OS_PS_READY)
-		{
-			readyProcesses[numReady] = i;
-			numReady++;
-		}
-		if (processes[i].state == OS_PS_BLOCKED)
-		{
-			os_getProcessSlot(i)->state = OS_PS_READY;
-		}
+		return 0;
 	}
 	
-	if (numReady == 0)
+	// skip whole nibbles until the chosen process is in the lowest one
+	uint8_t next = rand() % bitCount(ready);
+	uint8_t base = 0;
+	while (next >= pgm_read_byte(&bitCountOf[ready & 0xF]))
 	{
-		return 0;
+		next -= pgm_read_byte(&bitCountOf[ready & 0xF]);
+		ready >>= 4;
+		base += 4;
 	}
-	
-	int next = rand() % numReady;
-	return readyProcesses[next];
+	for (; next; next--)
+	{
+		ready &= ready - 1;
+	}
+	return base + lowestBit(ready);
 }
 
 /*!
@@ -152,7 +210,7 @@ ProcessID os_Scheduler_Random(Process const processes[], ProcessID current) {
  *  \return The next process to be executed determined on the basis of the round robin strategy.
  */
 ProcessID os_Scheduler_RoundRobin(Process const processes[], ProcessID current) {
-	if (processes[current].state != OS_PS_UNUSED && processes[current].state != OS_PS_BLOCKED && schedulingInfo.timeSlice > 1)
+	if (os_isRunnable(&processes[current]) && schedulingInfo.timeSlice > 1)
 	{
 		schedulingInfo.timeSlice--;
 		return current;
@@ -176,42 +234,27 @@ ProcessID os_Scheduler_RoundRobin(Process const processes[], ProcessID current)
  *  \return The next process to be executed, determined based on the inactive-aging strategy.
  */
 ProcessID os_Scheduler_InactiveAging(Process const processes[], ProcessID current) {
+	if (!readySet.all)
+	{
+		return current;
+	}
 	// the age of every waiting process is increased by its priority
-	for (uint8_t i = 0; i < MAX_NUMBER_OF_PROCESSES; i++)
+	for (ProcessMask waiting = readySet.all; waiting; waiting &= waiting - 1)
 	{
-		if ((processes[i].state==OS_PS_READY))
-		{
-			schedulingInfo.age[i] += processes[i].priority;
-		}
+		ProcessID const i = lowestBit(waiting);
+		schedulingInfo.age[i] += processes[i].priority;
 	}
-	ProcessID next = current;
-	uint8_t max = 0;
-	for (uint8_t i = 0; i < MAX_NUMBER_OF_PROCESSES; i++){
-		if (processes[i].state == OS_PS_BLOCKED)
+	ProcessID next = lowestBit(readySet.all);
+	for (ProcessMask waiting = readySet.all & (readySet.all - 1); waiting; waiting &= waiting - 1)
+	{
+		ProcessID const i = lowestBit(waiting);
+		// the oldest process is chosen
+		// If the oldest process is not distinct, the one with the highest priority is chosen
+		// If this is not distinct as well, the one with the lower ProcessID is chosen, which is the one visited first
+		if (schedulingInfo.age[i] > schedulingInfo.age[next]
+			|| (schedulingInfo.age[i] == schedulingInfo.age[next] && processes[i].priority > processes[next].priority))
 		{
-			os_getProcessSlot(i)->state = OS_PS_READY;
-		}
-		else{
-			// the oldest process is chosen
-			if (schedulingInfo.age[i] > max)
-			{
-				max = schedulingInfo.age[i];
-				next = i;
-				// If the oldest process is not distinct, the one with the highest priority is chosen
-			}else if (schedulingInfo.age[i] == max)
-			{
-				if (processes[i].priority > processes[next].priority)
-				{
-					next = i;
-					// If this is not distinct as well, the one with the lower ProcessID is chosen
-				}else if (processes[i].priority == processes[next].priority)
-				{
-					if (i < next)
-					{
-						next = i;
-					}
-				}
-			}
+			next = i;
 		}
 	}
 	schedulingInfo.age[next] = processes[next].priority;
@@ -241,55 +284,40 @@ ProcessID os_Scheduler_RunToCompletion(Process const processes[], ProcessID curr
 // and gets a default amount of timeslices which are class dependent. 
 // If a process has no timeslices left, it is moved to the next class. 
 // If a process yields, it is moved to the end of the queue.
+// The priority-class of a process is its band in the ready set, so the highest class with a ready process is found without visiting the queues.
 ProcessID os_Scheduler_MLFQ(Process const processes[], ProcessID current){
-	ProcessID id = 0;
-	bool rearranged = false; // to check if the 4 process queues are rearranged
-	// check from the highest priority class
-	for (uint8_t q = 0; q < 4; q++) {
+	while (readySet.bands) {
+		uint8_t const q = lowestBit(readySet.bands);
 		ProcessQueue *queue = MLFQ_getQueue(q);
-		uint8_t oldhead = queue->head; // to record the actual end of the queue to stop the search correctly
-		for (uint8_t i = queue->tail; i != oldhead; i = (i+1)%queue->size) {
-			id = pqueue_getFirst(queue);
-			if (processes[id].state == OS_PS_UNUSED || id == 0) {
-				pqueue_dropFirst(queue);
-			}
-			// if the time slice of the process in this class turns to 0, put the process into the lower class
-			else if (schedulingInfo.zeitScheiben[id] == 0) {
-				pqueue_dropFirst(queue);
-				if (processes[id].state == OS_PS_BLOCKED) {
-					os_getProcessSlot(id)->state = OS_PS_READY;
-				}
-				if (q + 1 < 4)
-				{
-					pqueue_append(MLFQ_getQueue(q + 1), id);
-					// initialize the new time slice of the process in the lower class
-					schedulingInfo.zeitScheiben[id] = MLFQ_getDefaultTimeslice(q + 1);
-				}
-				// Befindet sich der Prozess bereits in der niedrigsten Klasse
-				else
-				{
-					pqueue_append(MLFQ_getQueue(3), id);
-					// renew the time slice of the process
-					schedulingInfo.zeitScheiben[id] = MLFQ_getDefaultTimeslice(3);
-				}
-				rearranged = true;
-			}
-			else if (processes[id].state == OS_PS_READY) {
-				schedulingInfo.zeitScheiben[id]--;
-				return id;
-			}
-			else if (processes[id].state == OS_PS_BLOCKED) {
-				pqueue_dropFirst(queue);
-				os_getProcessSlot(id)->state = OS_PS_READY;
-				pqueue_append(queue,id);
-				rearranged = true;
+		if (!pqueue_hasNext(queue)) {
+			os_error("MLFQ lost a process");
+			return 0;
+		}
+		ProcessID const id = pqueue_getFirst(queue);
+		if (!(readySet.bandMembers[q] & ((ProcessMask)1 << id))) {
+			// a process that yielded or waits goes to the end of its queue, a killed one is dropped
+			pqueue_dropFirst(queue);
+			if (processes[id].state != OS_PS_UNUSED) {
+				pqueue_append(queue, id);
 			}
 		}
+		// if the time slice of the process in this class turns to 0, put the process into the lower class
+		else if (schedulingInfo.zeitScheiben[id] == 0) {
+			// Befindet sich der Prozess bereits in der niedrigsten Klasse, bleibt er dort
+			uint8_t const lower = q + 1 < 4 ? q + 1 : 3;
+			pqueue_dropFirst(queue);
+			pqueue_append(MLFQ_getQueue(lower), id);
+			os_readySetMove(id, lower);
+			// initialize the new time slice of the process in the lower class
+			schedulingInfo.zeitScheiben[id] = MLFQ_getDefaultTimeslice(lower);
+		}
+		else {
+			schedulingInfo.zeitScheiben[id]--;
+			return id;
+		}
 	}
-	// if the process queues are rearranged, there could be still process remainign it the queues, before the idle process is returned.
-	// So as long as the process queues are rearranged, we need to keep checking the whole process queues.
-	if (rearranged) {return os_Scheduler_MLFQ(processes,current);}
-	return 0;
+	// a process that yielded gets the processor back before the idle process does
+	return processes[current].state == OS_PS_BLOCKED ? current : 0;
 }
 
 // Initializes the given ProcessQueue with a predefined size.
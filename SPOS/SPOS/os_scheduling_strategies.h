@@ -22,6 +22,31 @@ typedef struct {
 	uint8_t tail;
 } ProcessQueue;
 
+//! Bitmap holding one bit per process slot.
+#if MAX_NUMBER_OF_PROCESSES <= 8
+typedef uint8_t ProcessMask;
+#elif MAX_NUMBER_OF_PROCESSES <= 16
+typedef uint16_t ProcessMask;
+#else
+#error "The ready set holds at most 16 processes"
+#endif
+
+//! Number of priority bands, a process starts in the band of the two top bits of its priority (band 0 for 0b11xxxxxx).
+#define READY_BANDS 4
+
+/*!
+ *  The processes that can be selected to run, i.e. the ones that are ready or running.
+ *  The set is updated on every state change, so the strategies pick the next process
+ *  without looking at the states of all process slots.
+ *  The idle process is part of all but not of any band.
+ */
+typedef struct {
+	ProcessMask all;
+	ProcessMask bandMembers[READY_BANDS];
+	uint8_t bands; // bit b is set if bandMembers[b] is not empty
+	uint8_t bandOf[MAX_NUMBER_OF_PROCESSES];
+} ReadySet;
+
 //! Structure used to store specific scheduling informations such as a time slice
 typedef struct {
 	Age age[MAX_NUMBER_OF_PROCESSES];
@@ -54,6 +79,18 @@ ProcessID os_Scheduler_RunToCompletion(Process const processes[], ProcessID curr
 //! MultiLevelFeedbackQueue strategy.
 ProcessID os_Scheduler_MLFQ(Process const processes[], ProcessID current);
 
+//! Adds a process to the ready set
+void os_readySetAdd(ProcessID pid);
+
+//! Removes a process from the ready set
+void os_readySetRemove(ProcessID pid);
+
+//! Moves a process to another priority band
+void os_readySetMove(ProcessID pid, uint8_t band);
+
+//! Returns the processes that are ready or running
+ProcessMask os_getReadyMask(void);
+
 // Initialises the scheduling information.
 void os_initSchedulingInformation(void);
 
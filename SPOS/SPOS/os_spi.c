@@ -1,9 +1,30 @@
 #include "os_spi.h"
+#include "os_core.h"
+#include "os_sync.h"
+
+//! CPU cycles the SPI interrupt takes to store a byte and send the next one, devices that exchange a byte faster are polled
+#define SPI_INTERRUPT_CYCLES 80
+
+//! Queue of the submitted transfers, the first one is on the bus
+static SpiTransfer* volatile spiQueueHead;
+static SpiTransfer* spiQueueTail;
+
+//! Processes that wait for a transfer or for the bus, they are woken up whenever a transfer is done
+static ProcessQueue spiWaiters = { .size = MAX_NUMBER_OF_PROCESSES };
+
+//! Set if a transfer was done within a critical section, the waiters are woken up by the next scheduler tick then
+static volatile bool spiWakePending;
+
+//! Whether a polled user holds the bus, queued transfers wait for it to be unlocked
+static volatile bool spiLocked;
+
+//! Device whose settings the SPI module currently uses
+static SpiDevice const* spiConfigured;
 
 // Configures relevant I/O registers/pins and initializes the SPI module.
 void os_spi_init() {
 	// Konfiguration der I/O-Pins fr den SPI-Bus
-	// B4: \CS
+	// B4: \SS, has to be an output for the SPI module to stay master
 	DDRB |= 0b00010000; // Set Pin B4 as output
 	// B5: MOSI
 	DDRB |= 0b00100000; // Set Pin B5 as output
@@ -14,14 +35,29 @@ void os_spi_init() {
 	DDRB |= 0b10000000; // Set Pin B7 as output
 	// SPI-Konfiguration
 	SPCR |= (1 << SPE) | (1 << MSTR); // Aktivieren des SPI-Moduls, Master-Modus
-	// Setzen der SPI-Taktfrequenz (Prescaler) fCPU/2
-	SPCR &= 0b11111101; // Setze SPR1 auf 0
-	SPCR &= 0b11111110; // Setze SPR0 auf 0
-	SPSR |= 0b00000001; // Setze SPI2X auf 1
+	// Clock rate and mode are set for each device as soon as it uses the bus
+	spiConfigured = NULL;
+}
+
+// Configures the chip-select pin of a device and deselects it.
+void os_spi_initDevice(SpiDevice const* device) {
+	DDRB |= device->csMask;
+	PORTB |= device->csMask;
+}
+
+// Switches the SPI module to the settings of a device unless it already uses them.
+static void spi_configure(SpiDevice const* device) {
+	if (device == spiConfigured) {
+		return;
+	}
+	SPCR = (SPCR & (1 << SPIE)) | (1 << SPE) | (1 << MSTR) | device->control;
+	SPSR = device->doubleSpeed ? (1 << SPI2X) : 0;
+	spiConfigured = device;
 }
 
 // Performs a SPI send This method blocks until the data exchange is completed.
 // Additionally, this method returns the byte which is received in exchange during the communication.
+// The caller has to hold the bus, see os_spi_lock.
 uint8_t os_spi_send(uint8_t data) {
 	
 	// Setze das zu sendende Datenbyte
@@ -40,4 +76,200 @@ uint8_t os_spi_receive(void) {
 	uint8_t receivedByte = os_spi_send(0xFF); // Sende ein Dummy-Byte, um Daten zu empfangen
 
 	return receivedByte;
-}
\ No newline at end of file
+}
+
+// Returns the next byte the given transfer has to send.
+static uint8_t spi_nextByte(SpiTransfer const* transfer) {
+	if (transfer->position < transfer->headerLength) {
+		return transfer->header[transfer->position];
+	}
+	return transfer->tx ? transfer->tx[transfer->position - transfer->headerLength] : transfer->fill;
+}
+
+/*!
+ *  Returns whether the bytes of a device are exchanged in the SPI interrupt. At fOSC/2 a
+ *  byte takes 16 cycles, far less than the interrupt itself, so such a device is polled
+ *  by the processes that wait for its transfers instead.
+ */
+static bool spi_byInterrupt(SpiDevice const* device) {
+	static uint8_t const dividers[] = {4, 16, 64, 128};
+	uint16_t const cycles = 8 * (dividers[device->control & ((1 << SPR1) | (1 << SPR0))] >> device->doubleSpeed);
+	return cycles > SPI_INTERRUPT_CYCLES;
+}
+
+// Selects the device of a transfer and sends its first byte.
+static void spi_start(SpiTransfer* transfer) {
+	spi_configure(transfer->device);
+	if (spi_byInterrupt(transfer->device)) {
+		SPCR |= (1 << SPIE);
+	} else {
+		SPCR &= ~(1 << SPIE);
+	}
+	PORTB &= ~transfer->device->csMask;
+	SPDR = spi_nextByte(transfer);
+}
+
+// Starts working off the queue.
+static void spi_run(void) {
+	// Clear a completion flag left behind by os_spi_send before the interrupt may be enabled
+	(void)SPSR;
+	(void)SPDR;
+	spi_start(spiQueueHead);
+}
+
+/*!
+ *  Wakes up the processes waiting for the bus. Their wait queue is shared with the
+ *  scheduler, so this has to wait for the next scheduler tick within a critical section.
+ */
+static void spi_wake(void) {
+	if (TIMSK2 & (1 << OCIE2A)) {
+		spiWakePending = false;
+		os_wakeAll(&spiWaiters);
+	} else {
+		spiWakePending = true;
+	}
+}
+
+// Wakes up the processes waiting for the bus if a transfer was done within a critical section, called by the scheduler.
+void os_spi_wakeWaiters(void) {
+	if (spiWakePending) {
+		spi_wake();
+	}
+}
+
+/*!
+ *  Queues a transfer and returns immediately. The transfer is carried out byte by
+ *  byte in the SPI interrupt, or by os_spi_wait for a device fast enough to be polled.
+ *  If the bus is locked, the queue starts as soon as it is unlocked.
+ */
+void os_spi_submit(SpiTransfer* transfer) {
+	transfer->position = 0;
+	transfer->next = NULL;
+	if (transfer->headerLength == 0 && transfer->length == 0) {
+		transfer->done = true;
+		return;
+	}
+	transfer->done = false;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (spiQueueHead == NULL) {
+			spiQueueHead = spiQueueTail = transfer;
+			if (!spiLocked) {
+				spi_run();
+			}
+		} else {
+			spiQueueTail->next = transfer;
+			spiQueueTail = transfer;
+		}
+	}
+}
+
+// Returns whether a submitted transfer is done.
+bool os_spi_isDone(SpiTransfer const* transfer) {
+	return transfer->done;
+}
+
+/*!
+ *  Stores the byte that has just been exchanged and sends the next one.
+ *  A finished transfer releases its device, the next queued one is started and
+ *  the waiting processes are woken up.
+ */
+static void spi_step(void) {
+	SpiTransfer* transfer = spiQueueHead;
+	uint8_t const received = SPDR;
+	if (transfer->position >= transfer->headerLength && transfer->rx) {
+		transfer->rx[transfer->position - transfer->headerLength] = received;
+	}
+	transfer->position++;
+	if (transfer->position < transfer->headerLength + transfer->length) {
+		SPDR = spi_nextByte(transfer);
+		return;
+	}
+	PORTB |= transfer->device->csMask;
+	spiQueueHead = transfer->next;
+	// The descriptor may be gone as soon as it is marked as done
+	transfer->done = true;
+	if (spiQueueHead) {
+		spi_start(spiQueueHead);
+	} else {
+		SPCR &= ~(1 << SPIE);
+	}
+	spi_wake();
+}
+
+ISR(SPI_STC_vect) {
+	spi_step();
+}
+
+/*!
+ *  Lets the queue make progress for a caller that waits for a transfer or, if it is
+ *  NULL, for the bus. The next byte of a polled device is exchanged. While the SPI
+ *  interrupt works off the queue or the bus is locked, the caller sleeps until the
+ *  next transfer is done. Within a critical section or with interrupts disabled,
+ *  e.g. in the task manager or another ISR, nobody else can run, so the caller
+ *  spins and takes over the bytes of the interrupt if it cannot occur.
+ */
+static void spi_progress(SpiTransfer const* transfer) {
+	bool const interrupts = SREG & (1 << 7);
+	bool const maySleep = interrupts && (TIMSK2 & (1 << OCIE2A));
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		bool const waiting = transfer ? !transfer->done : (spiLocked || spiQueueHead);
+		if (!waiting) {
+			// the caller may go on
+		} else if (spiQueueHead && !spiLocked && (!(SPCR & (1 << SPIE)) || !interrupts)) {
+			if (SPSR & (1 << SPIF)) {
+				spi_step();
+			}
+		} else if (maySleep) {
+			// The interrupt stays disabled until the process is switched out, so it cannot miss its wake-up
+			os_enterCriticalSection();
+			os_waitIn(&spiWaiters);
+			os_leaveCriticalSection();
+		}
+	}
+}
+
+/*!
+ *  Waits until a submitted transfer is done. The caller sleeps while the transfer or
+ *  the ones in front of it are carried out in the SPI interrupt, and exchanges the
+ *  bytes of polled devices itself.
+ */
+void os_spi_wait(SpiTransfer const* transfer) {
+	while (!transfer->done) {
+		spi_progress(transfer);
+	}
+}
+
+/*!
+ *  Waits until the bus is free and reserves it for polled transfers with
+ *  os_spi_send on the given device, which the caller selects by itself.
+ *  Queued transfers are finished first, later ones wait until os_spi_unlock.
+ *  The lock is not recursive and an ISR using the bus must not interrupt its
+ *  holder, so bus users in ISRs have to be locked out by the holder.
+ */
+void os_spi_lock(SpiDevice const* device) {
+	bool acquired = false;
+	while (!acquired) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			if (!spiLocked && spiQueueHead == NULL) {
+				spiLocked = true;
+				spi_configure(device);
+				acquired = true;
+			}
+		}
+		if (!acquired) {
+			spi_progress(NULL);
+		}
+	}
+}
+
+// Releases the bus and starts the transfers queued in the meantime.
+void os_spi_unlock(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		spiLocked = false;
+		if (spiQueueHead) {
+			spi_run();
+		}
+		// Polled transfers need the processes that sleep for them, just like those waiting for the bus
+		spi_wake();
+	}
+}
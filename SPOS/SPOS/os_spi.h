@@ -5,12 +5,75 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/atomic.h>
+#include <stdbool.h>
 #include "util.h"
 
+//! Maximum number of command bytes that are sent in front of the data of a transfer
+#define SPI_HEADER_SIZE 4
+
+//! SPI modes, i.e. clock polarity and phase, for SpiDevice.control
+#define SPI_MODE_0 0
+#define SPI_MODE_1 (1 << CPHA)
+#define SPI_MODE_2 (1 << CPOL)
+#define SPI_MODE_3 ((1 << CPOL) | (1 << CPHA))
+
+//! Sends the least significant bit of every byte first
+#define SPI_LSB_FIRST (1 << DORD)
+
+//! Clock dividers for SpiDevice.control, SpiDevice.doubleSpeed halves them
+#define SPI_CLOCK_DIV4 0
+#define SPI_CLOCK_DIV16 (1 << SPR0)
+#define SPI_CLOCK_DIV64 (1 << SPR1)
+#define SPI_CLOCK_DIV128 ((1 << SPR1) | (1 << SPR0))
+
+/*!
+ *  A chip on the SPI bus, it is selected by pulling its chip-select pin on port B low.
+ *  The bus is switched to the settings of a device whenever it is used by another
+ *  device than the one before.
+ */
+typedef struct SpiDevice {
+	uint8_t csMask;
+	uint8_t control;             // mode, data order and clock divider, see SPI_MODE_0 etc.
+	bool doubleSpeed;            // sets SPI2X, e.g. fOSC/2 with SPI_CLOCK_DIV4
+} SpiDevice;
+
+/*!
+ *  Descriptor of an asynchronous SPI transfer. The device stays selected for the
+ *  whole transfer, which sends the header followed by length data bytes.
+ *  The descriptor belongs to the SPI engine until the transfer is done.
+ */
+typedef struct SpiTransfer {
+	SpiDevice const* device;
+	uint8_t header[SPI_HEADER_SIZE];
+	uint8_t headerLength;
+	uint8_t const* tx;           // data bytes to send, NULL sends the fill byte instead
+	uint8_t* rx;                 // receives the bytes exchanged for the data bytes, may be NULL
+	uint16_t length;
+	uint8_t fill;
+	// Managed by the SPI engine
+	uint16_t position;
+	volatile bool done;
+	struct SpiTransfer* next;
+} SpiTransfer;
+
 void os_spi_init(void);
 
+void os_spi_initDevice(SpiDevice const* device);
+
+void os_spi_lock(SpiDevice const* device);
+
+void os_spi_unlock(void);
+
 uint8_t os_spi_send(uint8_t data);
 
 uint8_t os_spi_receive(void);
 
+void os_spi_submit(SpiTransfer* transfer);
+
+bool os_spi_isDone(SpiTransfer const* transfer);
+
+void os_spi_wait(SpiTransfer const* transfer);
+
+void os_spi_wakeWaiters(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,228 @@
+/*! \file
+ *  \brief Synchronisation primitives for the OS.
+ *
+ *  A process that has to wait is taken out of the ready set and put into the
+ *  wait queue of the object it waits for, so no strategy selects it until it
+ *  is woken up. Waiters check their condition again once they run, as another
+ *  process may have been faster in the meantime.
+ */
+
+#include "os_sync.h"
+#include "os_scheduler.h"
+#include "os_core.h"
+
+//! Wait queue every waiting process sleeps in, so it can be taken out when it is killed
+static ProcessQueue *waitingIn[MAX_NUMBER_OF_PROCESSES];
+
+//! Mutexes every process holds, linked through nextHeld, so they can be unlocked when it is killed
+static Mutex *heldBy[MAX_NUMBER_OF_PROCESSES];
+
+/*!
+ *  Blocks the current process in a wait queue until os_wakeFirst or os_wakeAll
+ *  wakes it up. The caller has to hold a critical section, so the condition it
+ *  waits for cannot change before the process is queued, and has to check the
+ *  condition again afterwards.
+ *  The idle process has to stay ready, so it only gives its time slice away.
+ *
+ *  \param queue The wait queue to sleep in.
+ */
+void os_waitIn(ProcessQueue *queue) {
+	ProcessID const self = os_getCurrentProc();
+	if (self != 0) {
+		pqueue_append(queue, self);
+		waitingIn[self] = queue;
+		os_getProcessSlot(self)->state = OS_PS_WAITING;
+		os_readySetRemove(self);
+	}
+	os_yield();
+}
+
+// Makes a process that was taken out of its wait queue ready again.
+static void os_wake(ProcessID pid) {
+	waitingIn[pid] = NULL;
+	os_getProcessSlot(pid)->state = OS_PS_READY;
+	os_readySetAdd(pid);
+}
+
+/*!
+ *  Wakes up the process that waits longest in a wait queue.
+ *
+ *  \param queue The wait queue.
+ *  \return Whether there was a process to wake up.
+ */
+bool os_wakeFirst(ProcessQueue *queue) {
+	os_enterCriticalSection();
+	bool const waiting = pqueue_hasNext(queue);
+	if (waiting) {
+		ProcessID const pid = pqueue_getFirst(queue);
+		pqueue_dropFirst(queue);
+		os_wake(pid);
+	}
+	os_leaveCriticalSection();
+	return waiting;
+}
+
+/*!
+ *  Wakes up all processes of a wait queue, e.g. if they wait for different
+ *  conditions that are all affected by a change.
+ *
+ *  \param queue The wait queue.
+ */
+void os_wakeAll(ProcessQueue *queue) {
+	os_enterCriticalSection();
+	while (pqueue_hasNext(queue)) {
+		ProcessID const pid = pqueue_getFirst(queue);
+		pqueue_dropFirst(queue);
+		os_wake(pid);
+	}
+	os_leaveCriticalSection();
+}
+
+// Removes a process that is about to be killed from the wait queue it sleeps in.
+void os_cancelWait(ProcessID pid) {
+	os_enterCriticalSection();
+	if (waitingIn[pid]) {
+		pqueue_removePID(waitingIn[pid], pid);
+		waitingIn[pid] = NULL;
+	}
+	os_leaveCriticalSection();
+}
+
+// Initialises a semaphore with the given number of units.
+void os_sem_init(Semaphore *sem, uint8_t count) {
+	sem->count = count;
+	pqueue_init(&sem->waiters);
+}
+
+/*!
+ *  Takes one unit of a semaphore. If there is none, the process sleeps until
+ *  os_sem_post returns one.
+ *
+ *  \param sem The semaphore.
+ */
+void os_sem_wait(Semaphore *sem) {
+	os_enterCriticalSection();
+	while (sem->count == 0) {
+		os_waitIn(&sem->waiters);
+	}
+	sem->count--;
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Takes one unit of a semaphore if there is one.
+ *
+ *  \param sem The semaphore.
+ *  \return Whether a unit was taken.
+ */
+bool os_sem_tryWait(Semaphore *sem) {
+	os_enterCriticalSection();
+	bool const taken = sem->count > 0;
+	if (taken) {
+		sem->count--;
+	}
+	os_leaveCriticalSection();
+	return taken;
+}
+
+/*!
+ *  Returns one unit to a semaphore and wakes up the process that waits longest
+ *  for it. The caller keeps running, the woken process is only made ready.
+ *
+ *  \param sem The semaphore.
+ */
+void os_sem_post(Semaphore *sem) {
+	os_enterCriticalSection();
+	if (sem->count == UINT8_MAX) {
+		os_error("Semaphore overflow");
+		os_leaveCriticalSection();
+		return;
+	}
+	sem->count++;
+	os_wakeFirst(&sem->waiters);
+	os_leaveCriticalSection();
+}
+
+// Initialises a free mutex.
+void os_mutex_init(Mutex *mutex) {
+	mutex->owner = INVALID_PROCESS;
+	mutex->nextHeld = NULL;
+	pqueue_init(&mutex->waiters);
+}
+
+/*!
+ *  Locks a mutex. If another process holds it, the process sleeps until it is
+ *  unlocked. Locking a mutex twice is an error.
+ *
+ *  \param mutex The mutex.
+ */
+void os_mutex_lock(Mutex *mutex) {
+	os_enterCriticalSection();
+	ProcessID const self = os_getCurrentProc();
+	if (mutex->owner == self) {
+		os_error("Mutex locked twice");
+		os_leaveCriticalSection();
+		return;
+	}
+	while (mutex->owner != INVALID_PROCESS) {
+		os_waitIn(&mutex->waiters);
+	}
+	mutex->owner = self;
+	mutex->nextHeld = heldBy[self];
+	heldBy[self] = mutex;
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Unlocks a mutex held by the current process and wakes up the process that
+ *  waits longest for it.
+ *
+ *  \param mutex The mutex.
+ */
+void os_mutex_unlock(Mutex *mutex) {
+	os_mutex_abandon(mutex, os_getCurrentProc());
+}
+
+/*!
+ *  Unlocks a mutex on behalf of a process, e.g. one that is about to be killed.
+ *  It is an error if the process does not hold the mutex.
+ *
+ *  \param mutex The mutex.
+ *  \param pid The process holding the mutex.
+ */
+void os_mutex_abandon(Mutex *mutex, ProcessID pid) {
+	os_enterCriticalSection();
+	if (mutex->owner != pid) {
+		os_error("Mutex not held");
+		os_leaveCriticalSection();
+		return;
+	}
+	if (heldBy[pid] == mutex) {
+		heldBy[pid] = mutex->nextHeld;
+	} else {
+		for (Mutex *held = heldBy[pid]; held != NULL; held = held->nextHeld) {
+			if (held->nextHeld == mutex) {
+				held->nextHeld = mutex->nextHeld;
+				break;
+			}
+		}
+	}
+	mutex->owner = INVALID_PROCESS;
+	mutex->nextHeld = NULL;
+	os_wakeFirst(&mutex->waiters);
+	os_leaveCriticalSection();
+}
+
+/*!
+ *  Unlocks every mutex a process holds, so none of them stays owned by a dead
+ *  process or is inherited by the next process getting its ID.
+ *
+ *  \param pid The process that is about to be killed.
+ */
+void os_mutex_abandonAll(ProcessID pid) {
+	os_enterCriticalSection();
+	while (heldBy[pid] != NULL) {
+		os_mutex_abandon(heldBy[pid], pid);
+	}
+	os_leaveCriticalSection();
+}
@@ -0,0 +1,84 @@
+/*! \file
+ *  \brief Synchronisation primitives for the OS.
+ *
+ *  Contains counting semaphores and mutexes. Processes that have to wait for
+ *  them sleep in a wait queue of the object and are skipped by every
+ *  scheduling strategy until a post or unlock wakes them up.
+ */
+
+#ifndef _OS_SYNC_H
+#define _OS_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "defines.h"
+#include "os_scheduling_strategies.h"
+
+//----------------------------------------------------------------------------
+// Types
+//----------------------------------------------------------------------------
+
+//! Counting semaphore
+typedef struct {
+	uint8_t count;
+	ProcessQueue waiters;
+} Semaphore;
+
+//! Mutex, it is not recursive and only its owner may unlock it
+typedef struct Mutex {
+	ProcessID owner;        // INVALID_PROCESS while the mutex is free
+	ProcessQueue waiters;
+	struct Mutex *nextHeld; // next mutex held by the same owner
+} Mutex;
+
+//! Initialiser for a Semaphore with the given count, an alternative to os_sem_init for globals
+#define SEMAPHORE_INITIALIZER(COUNT) { .count = (COUNT), .waiters = { .size = MAX_NUMBER_OF_PROCESSES } }
+
+//! Initialiser for a free Mutex, an alternative to os_mutex_init for globals
+#define MUTEX_INITIALIZER { .owner = INVALID_PROCESS, .waiters = { .size = MAX_NUMBER_OF_PROCESSES } }
+
+//----------------------------------------------------------------------------
+// Function headers
+//----------------------------------------------------------------------------
+
+//! Blocks the current process in a wait queue until it is woken up
+void os_waitIn(ProcessQueue *queue);
+
+//! Wakes up the process that waits longest in a wait queue
+bool os_wakeFirst(ProcessQueue *queue);
+
+//! Wakes up all processes of a wait queue
+void os_wakeAll(ProcessQueue *queue);
+
+//! Removes a process that is about to be killed from the wait queue it sleeps in
+void os_cancelWait(ProcessID pid);
+
+//! Initialises a semaphore
+void os_sem_init(Semaphore *sem, uint8_t count);
+
+//! Takes one unit of a semaphore, waits for it if there is none
+void os_sem_wait(Semaphore *sem);
+
+//! Takes one unit of a semaphore if there is one without waiting
+bool os_sem_tryWait(Semaphore *sem);
+
+//! Returns one unit to a semaphore and wakes up a process waiting for it
+void os_sem_post(Semaphore *sem);
+
+//! Initialises a mutex
+void os_mutex_init(Mutex *mutex);
+
+//! Locks a mutex, waits until it is free if needed
+void os_mutex_lock(Mutex *mutex);
+
+//! Unlocks a mutex held by the current process
+void os_mutex_unlock(Mutex *mutex);
+
+//! Unlocks a mutex held by a process that is about to be killed
+void os_mutex_abandon(Mutex *mutex, ProcessID pid);
+
+//! Unlocks every mutex held by a process that is about to be killed
+void os_mutex_abandonAll(ProcessID pid);
+
+#endif
@@ -87,11 +87,11 @@ Program* os_getProgramSlot(Program);
 #define TM_MAINPAGES 8
 
 /*!
- *  How many heaps should the TM maximally support. This is
- *  slightly redundant to os_getMemDriverListLength() of the os_mem_drivers
- *  module, but the TM wants to be independent of that other define.
+ *  How many heaps should the TM maximally support. Heaps that are
+ *  registered at runtime are listed as well, so this covers every heap
+ *  os_registerHeap can take.
  */
-#define TM_HEAP_SUPPORT 3
+#define TM_HEAP_SUPPORT MAX_NUMBER_OF_HEAPS
 
 /*!
  *  When dumping the map of any heap, this define specifies how many
@@ -100,6 +100,12 @@ Program* os_getProgramSlot(Program);
  */
 #define TM_MAP_ENTRIES_PER_PAGE 20
 
+/*!
+ *  Number of pages of the heap statistics that show the whole heap, they
+ *  are followed by one page per process.
+ */
+#define TM_HEAP_STATS_PAGES 3
+
 /*!
  *  This is a wrapper for the os_getInput function of the os_input module.
  *  It is never used directly but utilizes a macro to use a stack variable as inputBuffer.
@@ -471,6 +477,7 @@ static tm_page tm_null;
 #define MAX4(Xa,X3...) (MAX2(Xa,(MAX3(X3))))
 #define MAX5(Xa,X4...) (MAX2(Xa,(MAX4(X4))))
 #define MAX6(Xa,X5...) (MAX2(Xa,(MAX5(X5))))
+#define MAX7(Xa,X6...) (MAX2(Xa,(MAX6(X6))))
 
 #if TM_COMPILE_SCHEDULING_SUPPORT
 #if VERSUCH >= 5
@@ -482,7 +489,7 @@ static tm_page tm_null;
 #endif
 
 #if TM_COMPILE_HEAP_SUPPORT
-#define MS_MAX_COUNT (MAX4(OS_MEM_FIRST, OS_MEM_NEXT, OS_MEM_BEST, OS_MEM_WORST) + 1)
+#define MS_MAX_COUNT (MAX7(OS_MEM_FIRST, OS_MEM_NEXT, OS_MEM_BEST, OS_MEM_WORST, OS_MEM_SLAB, OS_MEM_BUDDY, OS_MEM_TLSF) + 1)
 #endif
 
 /*!
@@ -991,7 +998,7 @@ static const char *getHeapName(uint8_t ram) {
 /*!
  *  The page to select which heap to inspect. Supports NULL-heaps.
  */
-make_pagehandler(tm_heap, tm_heap2, 0, 4, OS_PR_SHOW_HEAP, heapId, peekStack(0).param) {
+make_pagehandler(tm_heap, tm_heap2, 0, 5, OS_PR_SHOW_HEAP, heapId, peekStack(0).param) {
     uint16_t const ram = peekStack(0).param;
     if (ram >= os_getHeapListLength() || !os_lookupHeap(ram)) {
         return false;
@@ -1006,6 +1013,7 @@ make_pagehandler(tm_heap, tm_heap2, 0, 4, OS_PR_SHOW_HEAP, heapId, peekStack(0).
 static tm_page tm_heap_strategy;
 static tm_page tm_heap_contents;
 static tm_page tm_heap_chunks;
+static tm_page tm_heap_stats;
 static tm_page tm_heap_erase;
 
 /*!
@@ -1014,6 +1022,7 @@ static tm_page tm_heap_erase;
  *   - select a strategy
  *   - dump the map
  *   - browse chunks
+ *   - show statistics
  *   - erase everything
  */
 make_pagehandler(tm_heap2, tm_heap_strategy, 0, MS_MAX_COUNT, OS_PR_ALWAYS_ALLOW, null, 0) {
@@ -1028,17 +1037,24 @@ make_pagehandler(tm_heap2, tm_heap_strategy, 0, MS_MAX_COUNT, OS_PR_ALWAYS_ALLOW
             lcd_writeProgString(PSTR("Map content dump"));
             result->call = tm_heap_contents;
             result->param = 0;
-            result->range = (os_getUseSize(heap) + TM_MAP_ENTRIES_PER_PAGE - 1) / TM_MAP_ENTRIES_PER_PAGE;
+            result->range = ((os_getUseSize(heap) >> heap->granularityShift) + TM_MAP_ENTRIES_PER_PAGE - 1) / TM_MAP_ENTRIES_PER_PAGE;
             break;
         }
         case 2: {
             lcd_writeProgString(PSTR("Chunk browser"));
             result->call = tm_heap_chunks;
             result->param = 0;
-            result->range = os_getUseSize(heap);
+            result->range = os_getUseSize(heap) >> heap->granularityShift;
             break;
         }
         case 3: {
+            lcd_writeProgString(PSTR("Heap statistics"));
+            result->call = tm_heap_stats;
+            result->param = 0;
+            result->range = TM_HEAP_STATS_PAGES + MAX_NUMBER_OF_PROCESSES;
+            break;
+        }
+        case 4: {
             lcd_writeProgString(PSTR("Erase everything"));
             result->call = tm_heap_erase;
             result->param = 0;
@@ -1057,6 +1073,9 @@ makeStrategyNameLookup(getAllocationStratNames, 0x10, 0,
     {OS_MEM_NEXT,  PSTR("<Next Fit>     ")},
     {OS_MEM_BEST,  PSTR("<Best Fit>     ")},
     {OS_MEM_WORST, PSTR("<Worst Fit>    ")},
+    {OS_MEM_SLAB,  PSTR("<Slab>         ")},
+    {OS_MEM_BUDDY, PSTR("<Buddy>        ")},
+    {OS_MEM_TLSF,  PSTR("<TLSF>         ")},
 )
 
 /*!
@@ -1081,9 +1100,39 @@ make_pagehandler(tm_heap_strategy_set, tm_null, 0, 0, OS_PR_ALLOCATION, as, peek
                            setAS, heap);
 }
 
+#if MEM_WIDE_ADDRESSES
+//! Wide addresses take an extra digit, which replaces the blank behind them
+#define TM_ADDR_GAP ""
+#else
+#define TM_ADDR_GAP " "
+#endif
+
+/*!
+ *  Writes a heap address in hex, with MEM_WIDE_ADDRESSES as five digits.
+ */
+static void writeMemAddr(MemAddr addr) {
+#if MEM_WIDE_ADDRESSES
+    lcd_writeHexNibble(addr >> 16);
+#endif
+    lcd_writeHexWord(addr);
+}
+
+/*!
+ *  Writes a number of heap bytes, in KiB if it does not fit into 16 bits.
+ */
+static void writeMemSize(MemSize size) {
+#if MEM_WIDE_ADDRESSES
+    if (size > 0xFFFF) {
+        lcd_writeDec(size >> 10);
+        lcd_writeChar('K');
+        return;
+    }
+#endif
+    lcd_writeDec(size);
+}
+
 static MemValue derefMap(Heap const* heap, MemAddr usePtr) {
-    uint16_t const uOff = usePtr - os_getUseStart(heap);
-    return (heap->driver->read(os_getMapStart(heap) + uOff / 2) >> (((~uOff) & 1) << 2)) & 0xF;
+    return os_getMapEntry(heap, usePtr);
 }
 
 /*!
@@ -1091,14 +1140,24 @@ static MemValue derefMap(Heap const* heap, MemAddr usePtr) {
  */
 make_pagehandler(tm_heap_contents, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
     Heap* const heap = os_lookupHeap(peekStack(2).param);
-    uint16_t addr = os_getUseStart(heap) + peekStack(0).param *  TM_MAP_ENTRIES_PER_PAGE;
+    // Every entry stands for 2^granularityShift use bytes, the lines are labelled with the use address of their first entry
+    uint16_t uOff = peekStack(0).param * TM_MAP_ENTRIES_PER_PAGE;
+    MemSize const entries = os_getUseSize(heap) >> heap->granularityShift;
     uint8_t i, j;
+    // TM_MAP_ENTRIES_PER_PAGE is even, so every map byte is read once for both of its entries
+    MemValue mapByte = 0;
     for (i = 0; i < 2; i++) {
-        lcd_writeHexWord(addr);
-        lcd_writeProgString(PSTR(": "));
+        writeMemAddr(os_getUseStart(heap) + ((MemAddr)uOff << heap->granularityShift));
+        lcd_writeProgString(PSTR(":" TM_ADDR_GAP));
         for (j = 0; j < 16 - 6; j++) {
-            if (addr < os_getUseStart(heap) + os_getUseSize(heap)) {
-                lcd_writeHexNibble(derefMap(heap, addr++));
+            if (uOff < entries) {
+                if (!(uOff & 1)) {
+                    mapByte = heap->mapDriver->read(os_getMapStart(heap) + uOff / 2);
+                    lcd_writeHexNibble(mapByte >> 4);
+                } else {
+                    lcd_writeHexNibble(mapByte & 0xF);
+                }
+                uOff++;
             } else {
                 i = j = 16;
             }
@@ -1115,24 +1174,78 @@ make_pagehandler(tm_heap_contents, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
  */
 make_pagehandler(tm_heap_chunks, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
     Heap* const heap = os_lookupHeap(peekStack(2).param);
-    uint16_t const addr = os_getUseStart(heap) + peekStack(0).param;
+    // Chunks start at the first byte of a map entry, so only those are browsed
+    MemAddr const addr = os_getUseStart(heap) + ((MemAddr)peekStack(0).param << heap->granularityShift);
     MemValue const owner = derefMap(heap, addr);
     if (owner == 0 || owner == 0xF) {
         return false;
     }
-    lcd_writeProgString(PSTR("Chunk @"));
-    lcd_writeHexWord(addr);
+    lcd_writeProgString(PSTR("Chunk" TM_ADDR_GAP "@"));
+    writeMemAddr(addr);
     lcd_writeProgString(PSTR(" ("));
     lcd_writeChar((owner < MAX_NUMBER_OF_PROCESSES) ? '#' : '*');
     lcd_writeHexNibble(owner);
     lcd_writeChar(')');
     lcd_line2();
     lcd_writeProgString(PSTR("Length: ..."));
-    uint16_t const length = os_getChunkSize(heap, addr);
+    MemSize const length = os_getChunkSize(heap, addr);
     lcd_goto(2, 9);
     lcd_writeProgString(spaces16 + (16 - 3));
     lcd_goto(2, 9);
-    lcd_writeDec(length);
+    writeMemSize(length);
+    return true;
+}
+
+/*!
+ *  The page to display the statistics of the previously selected heap.
+ *  The first TM_HEAP_STATS_PAGES pages show the whole heap, the following
+ *  ones the used bytes of the shared chunks and of every process.
+ */
+make_pagehandler(tm_heap_stats, tm_null, 0, 0, OS_PR_SHOW_HEAP, null, 0) {
+    Heap* const heap = os_lookupHeap(peekStack(2).param);
+    uint16_t const page = peekStack(0).param;
+    HeapStats stats;
+    os_getHeapStats(heap, &stats);
+    switch (page) {
+        case 0: {
+            lcd_writeProgString(PSTR("Free: "));
+            writeMemSize(stats.freeBytes);
+            lcd_line2();
+            lcd_writeProgString(PSTR("Largest: "));
+            writeMemSize(stats.largestFreeExtent);
+            break;
+        }
+        case 1: {
+            lcd_writeProgString(PSTR("Extents: "));
+            lcd_writeDec(stats.freeExtentCount);
+            lcd_line2();
+            lcd_writeProgString(PSTR("Fragment.: "));
+            lcd_writeDec(stats.fragmentation);
+            lcd_writeChar('%');
+            break;
+        }
+        case 2: {
+            lcd_writeProgString(PSTR("High water:"));
+            lcd_line2();
+            writeMemSize(stats.highWater);
+            lcd_writeProgString(PSTR(" of "));
+            writeMemSize(os_getUseSize(heap));
+            break;
+        }
+        default: {
+            uint8_t const owner = page - TM_HEAP_STATS_PAGES;
+            if (owner == 0) {
+                lcd_writeProgString(PSTR("Shared chunks"));
+            } else {
+                lcd_writeProgString(PSTR("Process #"));
+                lcd_writeDec(owner);
+            }
+            lcd_line2();
+            lcd_writeProgString(PSTR("Used: "));
+            writeMemSize(stats.ownerBytes[owner]);
+            break;
+        }
+    }
     return true;
 }
 
@@ -1152,18 +1265,22 @@ make_pagehandler(tm_heap_erase2, tm_null, 0, 0, OS_PR_ERASE_HEAP, heapId, peekSt
     MemAddr end = os_getMapStart(heap) + os_getMapSize(heap);
     MemAddr const mapEnd = end;
     MemAddr ptr;
+    // The map may be kept on another memory than the use area
+    MemDriver* driver = heap->mapDriver;
     uint8_t lastProgress = 0;
     for (ptr = start; ptr < end; ptr++) {
-        heap->driver->write(ptr, 0);
-        uint8_t progress = (100ul * (uint16_t)(ptr - start)) / (uint16_t)(end - start);
+        driver->write(ptr, 0);
+        uint8_t progress = (100ul * (ptr - start)) / (end - start);
         if (((uint16_t)progress * 32ul) / 100ul != ((uint16_t)lastProgress * 32ul) / 100ul) {
             lcd_drawBar((lastProgress = progress));
         }
         if (ptr + 1 == mapEnd) {
             ptr = (start = os_getUseStart(heap)) - 1;
             end = os_getUseStart(heap) + os_getUseSize(heap);
+            driver = heap->driver;
         }
     }
+    os_resyncHeap(heap);
     tm_done();
     return true;
 }
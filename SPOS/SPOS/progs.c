@@ -15,18 +15,23 @@
 #include "defines.h"
 
 #define BACKGROUND_COLOR 16
+// Number of drawn segments that are kept on the external heap
+#define STROKE_CAPACITY 512
 void initializePaintApp(void);
 void handleButtonPress(uint8_t code, uint16_t x, uint16_t y);
 void handleTouchEvent(TouchEvent event);
 void defineColors(void);
 void drawColorGradient();
 uint8_t getColorFromGradientPosition(uint16_t x);
+void recordStroke(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
 
 
 uint8_t penSize = 5;
 uint8_t penColor = 14;
 uint8_t isEraserMode = 0;
 TouchEvent prevEvent;
+MemAddr strokes;
+uint16_t strokeCount;
 
 void initializePaintApp() {
 	// Initialize TLCD
@@ -55,6 +60,10 @@ void initializePaintApp() {
 	drawColorGradient();
 	tlcd_changePenSize(penSize);
 	tlcd_changeDrawColor(penColor);
+	
+	// Ring buffer of the drawn segments
+	strokes = os_malloc(extHeap, STROKE_CAPACITY * 4 * sizeof(uint16_t));
+	strokeCount = 0;
 }
 
 void handleButtonPress(uint8_t code, uint16_t x, uint16_t y) {
@@ -102,6 +111,7 @@ void handleTouchEvent(TouchEvent event) {
 		if (prevEvent.type == TOUCHPANEL_DRAG || prevEvent.type == TOUCHPANEL_DOWN)
 		{
 			tlcd_drawLine(prevEvent.x, prevEvent.y, event.x, event.y);
+			recordStroke(prevEvent.x, prevEvent.y, event.x, event.y);
 		}
 		prevEvent = event;
 	}
@@ -112,10 +122,22 @@ void handleTouchEvent(TouchEvent event) {
 			uint16_t x = event.x;
 			uint16_t y = event.y;
 			tlcd_drawPoint(x, y);
+			recordStroke(x, y, x, y);
 		}
 	}
 }
 
+// Stores a drawn segment on the external heap, the oldest ones are overwritten once the buffer is full.
+void recordStroke(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
+	if (!strokes) {
+		return;
+	}
+	uint16_t segment[4] = {x1, y1, x2, y2};
+	MemAddr addr = strokes + (strokeCount % STROKE_CAPACITY) * sizeof(segment);
+	extHeap->driver->writeBlock(addr, (MemValue const*)segment, sizeof(segment));
+	strokeCount++;
+}
+
 void defineColors() {
 	unsigned char white[] = {0x1B, 0x46, 0x50, 14, 255, 255, 255};
 	tlcd_sendCommand(white, 7);
@@ -250,6 +272,7 @@ void program1(void) {
 		if (!(PORTB & 0b00001000))
 		{
 			tlcd_clearDisplay();
+			strokeCount = 0;
 		}
 	}
 }
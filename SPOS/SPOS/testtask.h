@@ -0,0 +1,60 @@
+/*! \file
+ *  \brief Result output shared by the test tasks.
+ *
+ *  A test task shows FAIL and the reason on the LCD as soon as a check fails.
+ *  If every check passed, it waits for ENTER unless CONFIRM_REQUIRED is 0
+ *  and shows TEST PASSED.
+ */
+
+#ifndef _TESTTASK_H
+#define _TESTTASK_H
+
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "lcd.h"
+#include "util.h"
+#include "os_input.h"
+
+#ifndef WRITE
+    #define WRITE(str) lcd_writeProgString(PSTR(str))
+#endif
+#define TEST_PASSED \
+    do { ATOMIC { \
+        lcd_clear(); \
+        WRITE("  TEST PASSED   "); \
+    } } while (0)
+#define TEST_FAILED(reason) \
+    do { ATOMIC { \
+        lcd_clear(); \
+        WRITE("FAIL  "); \
+        WRITE(reason); \
+    } } while (0)
+#ifndef CONFIRM_REQUIRED
+    #define CONFIRM_REQUIRED 1
+#endif
+
+//! Waits for the user to confirm the result if CONFIRM_REQUIRED is set
+#if CONFIRM_REQUIRED
+    #define TEST_CONFIRM \
+        do { \
+            lcd_clear(); \
+            WRITE("  PRESS ENTER!  "); \
+            os_waitForInput(); \
+            os_waitForNoInput(); \
+        } while (0)
+#else
+    #define TEST_CONFIRM do {} while (0)
+#endif
+
+//! Ends a test task whose checks all passed
+#define TEST_SUCCESS \
+    do { \
+        TEST_CONFIRM; \
+        TEST_PASSED; \
+        lcd_line2(); \
+        WRITE(" WAIT FOR IDLE  "); \
+        delayMs(DEFAULT_OUTPUT_DELAY * 6); \
+    } while (0)
+
+#endif
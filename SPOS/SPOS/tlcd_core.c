@@ -9,9 +9,17 @@
 #include <stdlib.h>
 #include "os_core.h"
 #include "util.h"
+#include "os_spi.h"
 
 tlcdBuffer inputBuffer;
 
+//! The display on the SPI bus, it is clocked at fOSC/128 in mode 3 with the least significant bit first
+SpiDevice const tlcdDevice = {
+    .csMask = (1 << TLCD_SPI_CS_BIT),
+    .control = SPI_MODE_3 | SPI_LSB_FIRST | SPI_CLOCK_DIV128,
+    .doubleSpeed = false
+};
+
 /*!
  *  This function configures all relevant ports,
  *  initializes the pin change interrupt, the spi
@@ -24,21 +32,9 @@ void tlcd_init() {
 	PORTB |= 0b00000100;
 	// B3: Reset
 	DDRB |= 0b00001000; // Set Pin B3 as output
-    // B4: \CS
-    DDRB |= 0b00010000; // Set Pin B4 as output
-    // B5: MOSI
-    DDRB |= 0b00100000; // Set Pin B5 as output
-    // B6: MISO
-    DDRB &= 0b10111111; // Set Pin B6 as input
-	PORTB |= 0b01000000;
-    // B7: CLK
-    DDRB |= 0b10000000; // Set Pin B7 as output
-	tlcd_spi_disable();
-    // SPI-Konfiguration
-    SPCR = 0x7F;	// (1<<SPIE) only SPIE enabled
-    // Setzen der SPI-Taktfrequenz (Prescaler) fOSC/128
-    SPCR |= 0b00000010; // Setze SPR1 auf 1
-    SPCR |= 0b00000001; // Setze SPR0 auf 1
+    // TLCD_CS_BIT and B5 - B7: \CS, MOSI, MISO and CLK, the settings of the display are applied by the SPI bus whenever it talks to it
+    os_spi_init();
+    os_spi_initDevice(&tlcdDevice);
 
     // Pin change interrupt on PORTB
     PCICR = (1 << TLCD_SEND_BUFFER_IND_INT_MSK_PORT);
@@ -62,25 +58,16 @@ void tlcd_reset() {
 
 
 /*!
- *  This function writes a byte to the lcd via SPI
+ *  This function writes a byte to the lcd via SPI.
+ *  The caller has to hold the SPI bus for tlcdDevice, see os_spi_lock.
  *  \param byte The byte to be send to the lcd
  */
 uint8_t tlcd_writeByte(uint8_t byte) {
-	uint8_t receivedByte;
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		tlcd_spi_enable();
-		_delay_us(6);
-
-		SPDR = byte;  // Write byte to SPDR
-
-		// Wait for transmission to complete
-		while (!(SPSR & (1 << SPIF))) {}
-		receivedByte = SPDR;
-	
-		tlcd_spi_disable();
-	}
+	tlcd_spi_enable();
+	_delay_us(6);
+	uint8_t receivedByte = os_spi_send(byte);
+	tlcd_spi_disable();
 	return receivedByte;
-	
 }
 
 /*!
@@ -173,7 +160,9 @@ uint8_t tlcd_hasNextBufferElement() {
 void tlcd_requestData() {
 	bool acknowledged = false;
 	uint8_t bcc = 0x12 + 0x01 + S_BYTE;
+	// The pin change interrupt must not read from the display in the middle of the request
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		os_spi_lock(&tlcdDevice);
 		while (!acknowledged)
 		{
 			tlcd_writeByte(DC2_BYTE);
@@ -186,6 +175,7 @@ void tlcd_requestData() {
 				acknowledged = true;
 			}
 		}
+		os_spi_unlock();
 	}
 }
 
@@ -193,18 +183,22 @@ void tlcd_requestData() {
 /*!
  *  This function reads the complete content of the TLCD sending buffer into the
  *  local input buffer. After a complete frame has been received, the bcc is checked.
- *  In case of a checksum error, the package is ignored by resetting the input buffer
+ *  In case of a checksum error, the package is ignored by resetting the input buffer.
+ *  It holds the SPI bus and is therefore only called with interrupts disabled.
  */
 void tlcd_readData() {
+	os_spi_lock(&tlcdDevice);
     uint8_t frameStart = tlcd_readByte();
 	if (frameStart != DC1_BYTE)
 	{
+		os_spi_unlock();
 		tlcd_resetBuffer();
 		return;
 	}
 	uint8_t frameLen = tlcd_readByte();
 	if (frameLen == 0 || frameLen > INPUTBUFFER_SIZE)
 	{
+		os_spi_unlock();
 		tlcd_resetBuffer();
 		return;
 	}
@@ -216,6 +210,7 @@ void tlcd_readData() {
 		receivedChecksum += data[i];
 	}
 	calculatedChecksum = tlcd_readByte();
+	os_spi_unlock();
 	if (receivedChecksum != calculatedChecksum)
 	{
 		tlcd_resetBuffer();
@@ -240,7 +235,9 @@ void tlcd_sendCommand(const unsigned char* cmd, uint8_t len) {
 	}
 	uint8_t tlcd_returnValue = 0x15;
 	uint16_t bcc;
+	// The pin change interrupt must not read from the display in the middle of the command
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		os_spi_lock(&tlcdDevice);
 		while(tlcd_returnValue != ACK) {
 			bcc = 0;
 			tlcd_writeByte(DC1_BYTE);
@@ -254,5 +251,6 @@ void tlcd_sendCommand(const unsigned char* cmd, uint8_t len) {
 			tlcd_writeByte(bcc);
 			tlcd_returnValue = tlcd_readByte();
 		}
+		os_spi_unlock();
 	}
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 
+#include "defines.h"
 #include "os_memory.h"
 #include "os_core.h"
 
@@ -19,7 +20,7 @@
 #define TLCD_DDR DDRB
 #define TLCD_PIN PINB
 
-#define TLCD_SPI_CS_BIT PB4
+#define TLCD_SPI_CS_BIT TLCD_CS_BIT
 #define TLCD_SPI_MOSI_BIT PB5
 #define TLCD_SPI_MISO_BIT PB6
 #define TLCD_SPI_CLK_BIT PB7
@@ -88,6 +88,16 @@ Time os_systemTime_precise(void) {
 }
 
 
+/*!
+ * Function that returns the current system time in Timer 0 counts (approx. 13 us each) without converting it to ms.
+ * Useful to measure short intervals such as the sleep phases of the idle process.
+ *
+ * \return os_systemTime_overflows augmented by the TCNT0 counter register
+ */
+Time os_systemTime_ticks(void) {
+    return os_systemTime_augment();
+}
+
 /*!
  *  Function that may be used to wait for specific time intervals.
  *  Therefore, we calculate the relative time to wait. This value is added to the current system time
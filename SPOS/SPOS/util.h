@@ -33,6 +33,9 @@ Time os_systemTime_coarse(void);
 //! Precise system time in ms
 Time os_systemTime_precise(void);
 
+//! System time in Timer 0 counts
+Time os_systemTime_ticks(void);
+
 //! Waits for some milliseconds
 void delayMs(Time ms);
 